@@ -0,0 +1,123 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "bench_harness.h"
+
+namespace {
+  std::atomic<bool> count_allocations(false);
+  std::atomic<std::size_t> allocation_count(0);
+} // anonymous namespace
+
+// Counts the allocations of the binary while asked to. new[] and the
+// nothrow forms go through these two.
+void* operator new(std::size_t size) {
+  if (count_allocations.load(std::memory_order_relaxed)) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+namespace wins {
+
+namespace {
+  // Nearest-rank percentile of sorted samples.
+  double Percentile(const vector<double>& sorted, double p) {
+    size_t rank = (size_t)ceil(p * sorted.size());
+    return sorted[max<size_t>(rank, 1) - 1];
+  }
+
+  void WriteNumber(ostream& os, double v) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.10g", v);
+    os << buffer;
+  }
+} // anonymous namespace
+
+void CountAllocations(bool on) {
+  count_allocations.store(on, memory_order_relaxed);
+}
+
+size_t AllocationCount() {
+  return allocation_count.load(memory_order_relaxed);
+}
+
+BenchStats RunBench(int warmup, int repetitions, size_t ops,
+    const function<void()>& body) {
+  for (int i = 0; i < warmup; ++i) {
+    body();
+  }
+  vector<double> samples;
+  for (int i = 0; i < repetitions; ++i) {
+    auto start = chrono::steady_clock::now();
+    body();
+    chrono::duration<double, nano> elapsed =
+        chrono::steady_clock::now() - start;
+    samples.push_back(elapsed.count() / ops);
+  }
+  sort(samples.begin(), samples.end());
+
+  BenchStats stats;
+  stats.warmup = warmup;
+  stats.repetitions = repetitions;
+  stats.ops_per_repetition = ops;
+  stats.min_ns = samples.front();
+  stats.mean_ns = mean(samples);
+  stats.p50_ns = Percentile(samples, 0.5);
+  stats.p90_ns = Percentile(samples, 0.9);
+  stats.p99_ns = Percentile(samples, 0.99);
+  stats.max_ns = samples.back();
+  return stats;
+}
+
+void BenchReport::Add(const string& name,
+    const vector<pair<string, double>>& params, const BenchStats& stats) {
+  cases_.push_back({ name, params, stats });
+  fprintf(stderr, "%-24s", name.c_str());
+  for (auto& param : params) {
+    fprintf(stderr, " %s=%g", param.first.c_str(), param.second);
+  }
+  fprintf(stderr, ": p50 %.6g ns/op, p90 %.6g ns/op\n", stats.p50_ns,
+      stats.p90_ns);
+}
+
+void BenchReport::Write(ostream& os) const {
+  os << "{ \"suite\": \"" << suite_ << "\", \"cases\": [";
+  for (size_t i = 0; i < cases_.size(); ++i) {
+    auto& c = cases_[i];
+    os << (i == 0 ? "\n" : ",\n") << "  { \"name\": \"" << c.name <<
+        "\", \"params\": {";
+    for (size_t p = 0; p < c.params.size(); ++p) {
+      os << (p == 0 ? " \"" : ", \"") << c.params[p].first << "\": ";
+      WriteNumber(os, c.params[p].second);
+    }
+    os << " },\n    \"warmup\": " << c.stats.warmup <<
+        ", \"repetitions\": " << c.stats.repetitions <<
+        ", \"ops_per_repetition\": " << c.stats.ops_per_repetition <<
+        ", \"unit\": \"ns/op\",\n    ";
+    pair<const char*, double> values[] = {
+      { "min", c.stats.min_ns }, { "mean", c.stats.mean_ns },
+      { "p50", c.stats.p50_ns }, { "p90", c.stats.p90_ns },
+      { "p99", c.stats.p99_ns }, { "max", c.stats.max_ns },
+    };
+    for (auto& value : values) {
+      os << (value.first == values[0].first ? "\"" : ", \"") <<
+          value.first << "\": ";
+      WriteNumber(os, value.second);
+    }
+    os << " }";
+  }
+  os << "\n] }\n";
+}
+
+}
@@ -0,0 +1,64 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <ostream>
+
+#include "common_utils.h"
+
+namespace wins {
+
+// Timings of the repetitions of one benchmark case, per operation.
+struct BenchStats {
+  int warmup;
+  int repetitions;
+  size_t ops_per_repetition;
+  double min_ns;
+  double mean_ns;
+  double p50_ns;
+  double p90_ns;
+  double p99_ns;
+  double max_ns;
+};
+
+// Calls body warmup times untimed and then repetitions times timed. Every
+// call of body is taken to do ops operations.
+BenchStats RunBench(int warmup, int repetitions, size_t ops,
+    const function<void()>& body);
+
+// Starts or stops counting the calls of operator new, to check that a
+// benchmarked path does not allocate. Nothing is counted unless a benchmark
+// asks for it, so the daemon only pays for a load of the flag.
+void CountAllocations(bool on);
+// The number of calls of operator new counted so far.
+size_t AllocationCount();
+
+// Benchmark cases collected for one run, written out as JSON:
+//
+//   { "suite": "...", "cases": [
+//     { "name": "...", "params": { "points": 1000, ... },
+//       "warmup": 2, "repetitions": 10, "ops_per_repetition": 1000,
+//       "unit": "ns/op", "min": ..., "mean": ..., "p50": ..., "p90": ...,
+//       "p99": ..., "max": ... }, ... ] }
+class BenchReport {
+ private:
+  struct Case {
+    string name;
+    vector<pair<string, double>> params;
+    BenchStats stats;
+  };
+
+  string suite_;
+  vector<Case> cases_;
+
+ public:
+  explicit BenchReport(const string& suite) : suite_(suite) {}
+
+  // Also prints a one line summary of the case to stderr.
+  void Add(const string& name, const vector<pair<string, double>>& params,
+      const BenchStats& stats);
+  void Write(ostream& os) const;
+};
+
+}
+
+#endif // BENCH_HARNESS_H
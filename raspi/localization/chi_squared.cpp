@@ -0,0 +1,96 @@
+#include <cmath>
+
+#include "chi_squared.h"
+#include "gamma.hpp"
+
+namespace wins {
+
+// Past this x / 2 the upper tail of every tabulated df is below DBL_MIN.
+#define CHI_SQUARED_MAX_HALF_X 2000
+
+namespace {
+
+// With h = x / 2 and df = 2m or 2m + 1,
+//   even df: Q = exp(-h) * sum_{j=0}^{m-1} h^j / j!
+//   odd df:  Q = erfc(sqrt(h)) + exp(-h) * sqrt(h) *
+//                sum_{j=1}^{m} h^(j-1) / gamma(j + 1/2)
+// The coefficients of both sums are kept here, lowest power first.
+struct Coefficients {
+  double even[CHI_SQUARED_MAX_DF / 2 + 1];
+  double odd[CHI_SQUARED_MAX_DF / 2 + 1];
+
+  // Built in long double so that each coefficient is rounded only once.
+  Coefficients() {
+    long double even_j = 1;
+    long double odd_j = 2 / sqrtl(3.14159265358979323846L);  // 1 / gamma(3/2)
+    for (int j = 0; j <= CHI_SQUARED_MAX_DF / 2; ++j) {
+      even[j] = even_j;
+      odd[j] = odd_j;
+      even_j /= j + 1;
+      odd_j /= j + 1.5L;
+    }
+  }
+};
+
+const Coefficients& Table() {
+  static const Coefficients table;
+  return table;
+}
+
+double Horner(const double* coefficients, int count, double h) {
+  double sum = 0;
+  for (int j = count - 1; j >= 0; --j) {
+    sum = sum * h + coefficients[j];
+  }
+  return sum;
+}
+
+// exp(-h) * sum without underflowing exp(-h) first.
+double ScaleByExp(double sum, double h) {
+  if (h < 700) {
+    return sum * exp(-h);
+  }
+  return exp(log(sum) - h);
+}
+
+} // anonymous namespace
+
+double ChiSquaredUpperTail(double x, int df) {
+  if (x <= 0) {
+    return 1;
+  }
+  if (df > CHI_SQUARED_MAX_DF) {
+    return 1 - pchisq(x, df);
+  }
+  double h = x / 2;
+  if (h > CHI_SQUARED_MAX_HALF_X) {
+    return 0;
+  }
+  auto& table = Table();
+  int m = df / 2;
+  if (df % 2 == 0) {
+    return ScaleByExp(Horner(table.even, m, h), h);
+  }
+  double root = sqrt(h);
+  double tail = erfc(root);
+  if (m > 0) {
+    tail += ScaleByExp(root * Horner(table.odd, m, h), h);
+  }
+  return tail;
+}
+
+void ChiSquaredUpperTails(const double* x, const int* df, size_t count,
+    double* out) {
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = ChiSquaredUpperTail(x[i], df[i]);
+  }
+}
+
+void NormalDensities(const double* x, const double* mean,
+    const double* inv_std, size_t count, double* out) {
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = NormalDensity(x[i], mean[i], inv_std[i]);
+  }
+}
+
+}
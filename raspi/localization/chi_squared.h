@@ -0,0 +1,44 @@
+#ifndef CHI_SQUARED_H
+#define CHI_SQUARED_H
+
+#include <cmath>
+#include <cstddef>
+
+namespace wins {
+
+// Largest df with precomputed coefficients. Larger df fall back to the
+// incomplete gamma code in gamma.hpp.
+#define CHI_SQUARED_MAX_DF 256
+
+// Returns the upper tail 1 - pchisq(x, df) for a whole number df >= 1.
+//
+// For df <= CHI_SQUARED_MAX_DF this uses the closed form for integer df, a
+// polynomial in x / 2 with precomputed coefficients times exp(-x / 2), plus
+// erfc(sqrt(x / 2)) when df is odd. Every term is positive, so nothing
+// cancels and the relative error stays below (df + x / 2 + 4) * DBL_EPSILON
+// for x < 1400. The x / 2 part only shows up for odd df, from rounding
+// sqrt(x / 2) in the far tail of erfc. Past x = 1400, exp(-x / 2) would
+// underflow and is applied through logarithms instead, which loosens the
+// bound to about x * DBL_EPSILON.
+// Computing the upper tail directly also keeps its accuracy where
+// 1 - pchisq would round to 0.
+double ChiSquaredUpperTail(double x, int df);
+
+// Evaluates ChiSquaredUpperTail(x[i], df[i]) for i in [0, count).
+void ChiSquaredUpperTails(const double* x, const int* df, size_t count,
+    double* out);
+
+// dnorm(x, mean, 1 / inv_std), with the standard deviation given as its
+// inverse so that stored fingerprints need no division.
+inline double NormalDensity(double x, double mean, double inv_std) {
+  double z = (x - mean) * inv_std;
+  return 0.39894228040143267794 * inv_std * std::exp(-0.5 * z * z);
+}
+
+// Evaluates NormalDensity(x[i], mean[i], inv_std[i]) for i in [0, count).
+void NormalDensities(const double* x, const double* mean,
+    const double* inv_std, size_t count, double* out);
+
+}
+
+#endif // CHI_SQUARED_H
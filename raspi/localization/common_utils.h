@@ -19,8 +19,6 @@ namespace wins {
 
 using namespace std;
 
-#define DSCAN
-
 struct PointEstimate {
   double x_mean;
   double x_var;
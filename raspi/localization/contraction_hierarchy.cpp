@@ -0,0 +1,412 @@
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "contraction_hierarchy.h"
+
+namespace wins {
+
+#define CONTRACTION_HIERARCHY_BYTE_ORDER 0x01020304
+// Nodes a witness search may settle before giving up and keeping the
+// shortcut. Lower limits build faster but add needless shortcuts.
+#define WITNESS_MAX_SETTLED 50
+
+namespace {
+  const double kUnreached = numeric_limits<double>::infinity();
+
+  // An edge of the graph left while contracting, or of the hierarchy. middle
+  // is the node a shortcut skips, -1 for walk graph edges.
+  struct Arc {
+    int32_t target;
+    int32_t middle;
+    double length;
+  };
+
+  class Contractor {
+   private:
+    // Edges between nodes not contracted yet, both ways.
+    vector<vector<Arc>> arcs_;
+    // Contracted neighbors, to spread contraction evenly over the graph.
+    vector<int32_t> deleted_neighbors_;
+    IndexedHeap<double> order_;
+    // Witness search state.
+    vector<uint32_t> stamp_;
+    vector<double> cost_;
+    IndexedHeap<double> open_;
+    uint32_t generation_ = 0;
+    // Scratch list of shortcuts found for a node: the two ends and the
+    // length.
+    vector<pair<pair<int32_t, int32_t>, double>> shortcuts_;
+
+    bool Reached(int32_t node) const { return stamp_[node] == generation_; }
+
+    // Costs from source in the remaining graph without avoid, up to limit
+    // and WITNESS_MAX_SETTLED settled nodes.
+    void WitnessSearch(int32_t source, int32_t avoid, double limit) {
+      generation_ += 1;
+      open_.Clear();
+      stamp_[source] = generation_;
+      cost_[source] = 0;
+      open_.Push(source, 0);
+      for (int settled = 0; not open_.empty() and
+          open_.TopKey() <= limit and settled < WITNESS_MAX_SETTLED;
+          ++settled) {
+        int32_t current = open_.Pop();
+        for (auto& arc : arcs_[current]) {
+          if (arc.target == avoid) {
+            continue;
+          }
+          double new_cost = cost_[current] + arc.length;
+          if (not Reached(arc.target) or new_cost < cost_[arc.target]) {
+            stamp_[arc.target] = generation_;
+            cost_[arc.target] = new_cost;
+            open_.Push(arc.target, new_cost);
+          }
+        }
+      }
+    }
+
+    // Fills shortcuts_ with the shortcuts contracting node needs.
+    void FindShortcuts(int32_t node) {
+      shortcuts_.clear();
+      auto& arcs = arcs_[node];
+      for (size_t i = 0; i < arcs.size(); ++i) {
+        double longest = 0;
+        for (size_t j = i + 1; j < arcs.size(); ++j) {
+          longest = max(longest, arcs[j].length);
+        }
+        if (i + 1 == arcs.size()) {
+          break;
+        }
+        WitnessSearch(arcs[i].target, node, arcs[i].length + longest);
+        for (size_t j = i + 1; j < arcs.size(); ++j) {
+          double via = arcs[i].length + arcs[j].length;
+          int32_t to = arcs[j].target;
+          if (not Reached(to) or cost_[to] > via) {
+            shortcuts_.push_back({ { arcs[i].target, to }, via });
+          }
+        }
+      }
+    }
+
+    double Priority(int32_t node) {
+      FindShortcuts(node);
+      return (double)shortcuts_.size() - arcs_[node].size() +
+          deleted_neighbors_[node];
+    }
+
+    // Adds an edge from from to to, or shortens the one there is.
+    void AddArc(int32_t from, const Arc& arc) {
+      for (auto& existing : arcs_[from]) {
+        if (existing.target == arc.target) {
+          if (arc.length < existing.length) {
+            existing = arc;
+          }
+          return;
+        }
+      }
+      arcs_[from].push_back(arc);
+    }
+
+   public:
+    explicit Contractor(const WalkGraph& graph) :
+        arcs_(graph.num_nodes()), deleted_neighbors_(graph.num_nodes()),
+        stamp_(graph.num_nodes()), cost_(graph.num_nodes()) {
+      size_t num_nodes = graph.num_nodes();
+      open_.Resize(num_nodes);
+      order_.Resize(num_nodes);
+      for (size_t node = 0; node < num_nodes; ++node) {
+        for (int32_t e = graph.edges_begin(node); e < graph.edges_end(node);
+            ++e) {
+          arcs_[node].push_back({ graph.target(e), -1, graph.length(e) });
+        }
+      }
+      for (size_t node = 0; node < num_nodes; ++node) {
+        order_.Push(node, Priority(node));
+      }
+    }
+
+    // Contracts the remaining nodes in order and stores the edges from each
+    // to the nodes left when it was contracted in upward.
+    void Run(vector<vector<Arc>>& upward) {
+      upward.assign(arcs_.size(), vector<Arc>());
+      while (not order_.empty()) {
+        // Priorities only go stale in between, so recheck the best one.
+        int32_t node = order_.Top();
+        double priority = Priority(node);
+        if (priority > order_.TopKey()) {
+          order_.Push(node, priority);
+          if (order_.Top() != node) {
+            continue;
+          }
+        }
+        order_.Pop();
+
+        for (auto& arc : arcs_[node]) {
+          auto& back = arcs_[arc.target];
+          for (size_t i = 0; i < back.size(); ++i) {
+            if (back[i].target == node) {
+              back[i] = back.back();
+              back.pop_back();
+              break;
+            }
+          }
+          deleted_neighbors_[arc.target] += 1;
+        }
+        // Priority() has just found the shortcuts.
+        for (auto& shortcut : shortcuts_) {
+          int32_t from = shortcut.first.first;
+          int32_t to = shortcut.first.second;
+          AddArc(from, { to, node, shortcut.second });
+          AddArc(to, { from, node, shortcut.second });
+        }
+        upward[node].swap(arcs_[node]);
+        vector<Arc>().swap(arcs_[node]);
+      }
+    }
+  };
+} // anonymous namespace
+
+void ContractionHierarchy::Build(const WalkGraph& graph) {
+  vector<vector<Arc>> upward;
+  Contractor(graph).Run(upward);
+
+  num_edges_ = graph.num_edges();
+  tree_hash_ = graph.tree_hash();
+  radius_ = graph.radius();
+  offsets_.assign(1, 0);
+  targets_.clear();
+  lengths_.clear();
+  middles_.clear();
+  for (auto& arcs : upward) {
+    for (auto& arc : arcs) {
+      targets_.push_back(arc.target);
+      lengths_.push_back(arc.length);
+      middles_.push_back(arc.middle);
+    }
+    offsets_.push_back(targets_.size());
+  }
+}
+
+bool ContractionHierarchy::Load(const string& filename,
+    const WalkGraph& graph) {
+  ifstream is(filename, ios::binary);
+  ContractionHierarchyHeader header;
+  is.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (not is or
+      memcmp(header.magic, CONTRACTION_HIERARCHY_MAGIC,
+          sizeof(CONTRACTION_HIERARCHY_MAGIC)) != 0 or
+      header.version != CONTRACTION_HIERARCHY_VERSION or
+      header.byte_order != CONTRACTION_HIERARCHY_BYTE_ORDER or
+      header.num_nodes != graph.num_nodes() or
+      header.num_edges != graph.num_edges() or
+      header.tree_hash != graph.tree_hash() or
+      header.radius != graph.radius()) {
+    return false;
+  }
+  is.seekg(0, ios::end);
+  uint64_t expected = sizeof(header) +
+      (header.num_nodes + 1) * sizeof(int32_t) +
+      header.num_upward_edges * (2 * sizeof(int32_t) + sizeof(double));
+  if ((uint64_t)is.tellg() != expected) {
+    return false;
+  }
+  is.seekg(sizeof(header));
+  vector<int32_t> offsets(header.num_nodes + 1);
+  vector<int32_t> targets(header.num_upward_edges);
+  vector<double> lengths(header.num_upward_edges);
+  vector<int32_t> middles(header.num_upward_edges);
+  is.read(reinterpret_cast<char*>(offsets.data()),
+      offsets.size() * sizeof(int32_t));
+  is.read(reinterpret_cast<char*>(targets.data()),
+      targets.size() * sizeof(int32_t));
+  is.read(reinterpret_cast<char*>(lengths.data()),
+      lengths.size() * sizeof(double));
+  is.read(reinterpret_cast<char*>(middles.data()),
+      middles.size() * sizeof(int32_t));
+  if (not is or offsets.front() != 0 or
+      (uint64_t)offsets.back() != header.num_upward_edges) {
+    return false;
+  }
+  for (size_t i = 0; i < header.num_nodes; ++i) {
+    if (offsets[i] > offsets[i + 1]) {
+      return false;
+    }
+  }
+  for (size_t e = 0; e < header.num_upward_edges; ++e) {
+    if (targets[e] < 0 or (uint64_t)targets[e] >= header.num_nodes or
+        middles[e] < -1 or middles[e] >= (int64_t)header.num_nodes) {
+      return false;
+    }
+  }
+  num_edges_ = header.num_edges;
+  tree_hash_ = header.tree_hash;
+  radius_ = header.radius;
+  offsets_ = move(offsets);
+  targets_ = move(targets);
+  lengths_ = move(lengths);
+  middles_ = move(middles);
+  return true;
+}
+
+void ContractionHierarchy::Write(const string& filename) const {
+  ContractionHierarchyHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CONTRACTION_HIERARCHY_MAGIC,
+      sizeof(CONTRACTION_HIERARCHY_MAGIC));
+  header.version = CONTRACTION_HIERARCHY_VERSION;
+  header.byte_order = CONTRACTION_HIERARCHY_BYTE_ORDER;
+  header.num_nodes = num_nodes();
+  header.num_edges = num_edges_;
+  header.tree_hash = tree_hash_;
+  header.radius = radius_;
+  header.num_upward_edges = num_upward_edges();
+
+  ofstream os(filename, ios::binary);
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char*>(offsets_.data()),
+      offsets_.size() * sizeof(int32_t));
+  os.write(reinterpret_cast<const char*>(targets_.data()),
+      targets_.size() * sizeof(int32_t));
+  os.write(reinterpret_cast<const char*>(lengths_.data()),
+      lengths_.size() * sizeof(double));
+  os.write(reinterpret_cast<const char*>(middles_.data()),
+      middles_.size() * sizeof(int32_t));
+  if (not os) {
+    throw runtime_error("Could not write " + filename);
+  }
+}
+
+void ContractionHierarchy::Clear() {
+  offsets_.assign(1, 0);
+  targets_.clear();
+  lengths_.clear();
+  middles_.clear();
+}
+
+void ContractionHierarchy::ResetQuery() {
+  size_t nodes = num_nodes();
+  if (stamp_[0].size() != nodes) {
+    for (int side = 0; side < 2; ++side) {
+      stamp_[side].assign(nodes, 0);
+      cost_[side].resize(nodes);
+      parent_[side].resize(nodes);
+      open_[side].Resize(nodes);
+    }
+    generation_ = 0;
+  }
+  generation_ += 1;
+  if (generation_ == 0) {
+    // The stamps have wrapped around, old ones could look current again.
+    for (int side = 0; side < 2; ++side) {
+      fill(stamp_[side].begin(), stamp_[side].end(), 0);
+    }
+    generation_ = 1;
+  }
+  open_[0].Clear();
+  open_[1].Clear();
+  expanded_ = 0;
+}
+
+void ContractionHierarchy::Unpack(int32_t from, int32_t to,
+    vector<int32_t>& route) {
+  // Edges still to unpack, last one first.
+  auto& pending = pending_;
+  pending.assign(1, { from, to });
+  while (not pending.empty()) {
+    int32_t a = pending.back().first;
+    int32_t b = pending.back().second;
+    pending.pop_back();
+    // The edge is stored with whichever end was contracted first.
+    int32_t middle = -1;
+    for (int32_t e = offsets_[a]; e < offsets_[a + 1]; ++e) {
+      if (targets_[e] == b) {
+        middle = middles_[e];
+      }
+    }
+    for (int32_t e = offsets_[b]; e < offsets_[b + 1]; ++e) {
+      if (targets_[e] == a) {
+        middle = middles_[e];
+      }
+    }
+    if (middle < 0) {
+      route.push_back(b);
+    } else {
+      pending.push_back({ middle, b });
+      pending.push_back({ a, middle });
+    }
+  }
+}
+
+bool ContractionHierarchy::FindRoute(int32_t start, int32_t goal,
+    vector<int32_t>& route) {
+  route.clear();
+  ResetQuery();
+  int32_t ends[2] = { start, goal };
+  for (int side = 0; side < 2; ++side) {
+    stamp_[side][ends[side]] = generation_;
+    cost_[side][ends[side]] = 0;
+    parent_[side][ends[side]] = ends[side];
+    open_[side].Push(ends[side], 0);
+  }
+
+  double best = kUnreached;
+  int32_t meeting = -1;
+  while (true) {
+    // Take the closer node of the two searches, a search is done once its
+    // nodes are farther than the best route through a meeting node.
+    int side = -1;
+    for (int s = 0; s < 2; ++s) {
+      if (not open_[s].empty() and open_[s].TopKey() < best and
+          (side < 0 or open_[s].TopKey() < open_[side].TopKey())) {
+        side = s;
+      }
+    }
+    if (side < 0) {
+      break;
+    }
+    int32_t current = open_[side].Pop();
+    expanded_ += 1;
+    int other = 1 - side;
+    if (stamp_[other][current] == generation_ and
+        cost_[side][current] + cost_[other][current] < best) {
+      best = cost_[side][current] + cost_[other][current];
+      meeting = current;
+    }
+    for (int32_t e = offsets_[current]; e < offsets_[current + 1]; ++e) {
+      int32_t next = targets_[e];
+      double new_cost = cost_[side][current] + lengths_[e];
+      if (stamp_[side][next] != generation_ or
+          new_cost < cost_[side][next]) {
+        stamp_[side][next] = generation_;
+        cost_[side][next] = new_cost;
+        parent_[side][next] = current;
+        open_[side].Push(next, new_cost);
+      }
+    }
+  }
+  if (meeting < 0) {
+    return false;
+  }
+
+  // Hierarchy nodes from the goal up to the meeting node and down to the
+  // start, each then unpacked into the walk graph nodes in between.
+  auto& path = path_;
+  path.clear();
+  for (int32_t node = meeting; node != goal; node = parent_[1][node]) {
+    path.push_back(parent_[1][node]);
+  }
+  reverse(path.begin(), path.end());
+  path.push_back(meeting);
+  for (int32_t node = meeting; node != start; node = parent_[0][node]) {
+    path.push_back(parent_[0][node]);
+  }
+  route.push_back(goal);
+  for (size_t i = 1; i < path.size(); ++i) {
+    Unpack(path[i - 1], path[i], route);
+  }
+  return true;
+}
+
+}
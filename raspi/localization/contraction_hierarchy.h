@@ -0,0 +1,108 @@
+#ifndef CONTRACTION_HIERARCHY_H
+#define CONTRACTION_HIERARCHY_H
+
+#include <cstdint>
+
+#include "common_utils.h"
+#include "indexed_heap.h"
+#include "walk_graph.h"
+
+namespace wins {
+
+#define CONTRACTION_HIERARCHY_MAGIC "WINSCH"
+#define CONTRACTION_HIERARCHY_VERSION 1
+#define CONTRACTION_HIERARCHY_SUFFIX ".ch"
+
+// A contraction hierarchy over a WalkGraph (Geisberger et al., 2008). Nodes
+// are contracted one by one, least important first. Contracting a node
+// removes it, and adds a shortcut between two of its neighbors whenever the
+// route through it was the only shortest one. The result is kept as the
+// upward edges of every node: its edges, shortcuts included, to nodes
+// contracted after it.
+//
+// A shortest route then goes up the hierarchy and back down, so it is found
+// by two small searches that only follow upward edges, one from each end.
+// Walk graph edges are symmetric, so both searches use the same edges. A
+// shortcut records the node it skips, so routes unpack into walk graph
+// nodes.
+//
+// The hierarchy can be cached in a side-car of the map file. Layout:
+//
+//   header   ContractionHierarchyHeader
+//   offsets  int32_t[num_nodes + 1]
+//   targets  int32_t[num_upward_edges]
+//   lengths  double[num_upward_edges]
+//   middles  int32_t[num_upward_edges], -1 for walk graph edges
+//
+// A side-car only matches the graph it was built over, which the header
+// identifies by its tree hash, radius and size.
+struct ContractionHierarchyHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t num_nodes;
+  uint64_t num_edges;
+  uint64_t tree_hash;
+  double radius;
+  uint64_t num_upward_edges;
+};
+
+class ContractionHierarchy {
+ private:
+  uint64_t num_edges_ = 0;
+  uint64_t tree_hash_ = 0;
+  double radius_ = 0;
+  // The upward edges of node i are [offsets_[i], offsets_[i + 1]).
+  vector<int32_t> offsets_ = { 0 };
+  vector<int32_t> targets_;
+  vector<double> lengths_;
+  vector<int32_t> middles_;
+
+  // Query state, per direction: 0 searches up from the start, 1 from the
+  // goal. Stamped like RouteSearch so nothing is cleared between queries.
+  vector<uint32_t> stamp_[2];
+  vector<double> cost_[2];
+  vector<int32_t> parent_[2];
+  IndexedHeap<double> open_[2];
+  uint32_t generation_ = 0;
+  size_t expanded_ = 0;
+  // Scratch buffers for unpacking routes.
+  vector<int32_t> path_;
+  vector<pair<int32_t, int32_t>> pending_;
+
+  void ResetQuery();
+  // Appends the walk graph nodes from from to to, from excluded, to route.
+  void Unpack(int32_t from, int32_t to, vector<int32_t>& route);
+
+ public:
+  // The side-car name used for a map file.
+  static string FileFor(const string& map_filename) {
+    return map_filename + CONTRACTION_HIERARCHY_SUFFIX;
+  }
+
+  // Contracts the whole graph. Meant for offline use, it takes a few
+  // seconds for a hundred thousand nodes.
+  void Build(const WalkGraph& graph);
+  // Returns false, leaving the hierarchy as it was, if the file is missing
+  // or does not match graph.
+  bool Load(const string& filename, const WalkGraph& graph);
+  void Write(const string& filename) const;
+  // Drops the hierarchy, empty() is then true.
+  void Clear();
+
+  bool empty() const { return num_nodes() == 0; }
+  size_t num_nodes() const { return offsets_.size() - 1; }
+  size_t num_upward_edges() const { return targets_.size(); }
+
+  // Finds the cheapest route from start to goal like RouteSearch does. The
+  // route is stored in route from goal back to start, both included.
+  // Returns false and leaves route empty if goal cannot be reached.
+  bool FindRoute(int32_t start, int32_t goal, vector<int32_t>& route);
+
+  // Number of nodes taken off either open set by the last query.
+  size_t expanded() const { return expanded_; }
+};
+
+}
+
+#endif // CONTRACTION_HIERARCHY_H
@@ -607,7 +607,9 @@ Page Display::DestinationPrompt() {
 
     ClearLine(3);
     SetCurrentLine(3);
-    if (Navigation::TrySetDestinationFromCoords(GetStringAndEcho())) {
+    string destination = GetStringAndEcho();
+    if (Navigation::TrySetDestinationFromCoords(destination) or
+        Navigation::TrySetDestinationFromPoi(destination)) {
       break;
     }
     SetCurrentLine(1);
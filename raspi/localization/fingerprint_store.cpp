@@ -0,0 +1,156 @@
+#include <cmath>
+
+#include "fingerprint_store.h"
+#include "flat_map.h"
+
+namespace wins {
+
+// Rows are padded so that every row starts on a 32 byte boundary relative to
+// the start of the matrix.
+#define AP_STRIDE_ALIGN 4
+
+void FingerprintStore::InternMacs() {
+  ap_ids_.clear();
+  ap_ids_.reserve(macs_.size());
+  for (size_t i = 0; i < macs_.size(); ++i) {
+    ap_ids_[macs_[i]] = i;
+  }
+}
+
+void FingerprintStore::Build(const vector<unique_ptr<Point>>& points) {
+  // Sort the MACs so that ids do not depend on hash table iteration order.
+  macs_.clear();
+  for (auto& point : points) {
+    for (auto& kv : point->info) {
+      macs_.push_back(kv.first);
+    }
+  }
+  sort(macs_.begin(), macs_.end());
+  macs_.erase(unique(macs_.begin(), macs_.end()), macs_.end());
+  InternMacs();
+
+  num_points_ = points.size();
+  ap_stride_ = (macs_.size() + AP_STRIDE_ALIGN - 1) / AP_STRIDE_ALIGN *
+      AP_STRIDE_ALIGN;
+  mask_words_ = (macs_.size() + 63) / 64;
+  owned_mean_.assign(num_points_ * ap_stride_, 0);
+  owned_var_.assign(num_points_ * ap_stride_, 1);
+  owned_inv_std_.assign(num_points_ * ap_stride_, 0);
+  owned_presence_.assign(num_points_ * mask_words_, 0);
+
+  for (size_t p = 0; p < num_points_; ++p) {
+    auto& point = points[p];
+    point->id = p;
+    for (auto& kv : point->info) {
+      // A negative mean has always meant "unknown" to the estimators.
+      if (kv.second.mean < 0) {
+        continue;
+      }
+      int ap = ap_ids_[kv.first];
+      owned_mean_[p * ap_stride_ + ap] = kv.second.mean;
+      owned_var_[p * ap_stride_ + ap] = kv.second.var;
+      owned_inv_std_[p * ap_stride_ + ap] = 1 / sqrt(kv.second.var);
+      owned_presence_[p * mask_words_ + (ap >> 6)] |=
+          (uint64_t)1 << (ap & 63);
+    }
+  }
+  mean_ = owned_mean_.data();
+  var_ = owned_var_.data();
+  inv_std_ = owned_inv_std_.data();
+  presence_ = owned_presence_.data();
+
+  owned_ap_offsets_.assign(macs_.size() + 1, 0);
+  for (size_t p = 0; p < num_points_; ++p) {
+    for (size_t ap = 0; ap < macs_.size(); ++ap) {
+      if (Seen(p, ap)) {
+        owned_ap_offsets_[ap + 1] += 1;
+      }
+    }
+  }
+  for (size_t ap = 0; ap < macs_.size(); ++ap) {
+    owned_ap_offsets_[ap + 1] += owned_ap_offsets_[ap];
+  }
+  owned_ap_points_.resize(owned_ap_offsets_.back());
+  vector<int> fill(owned_ap_offsets_.begin(), owned_ap_offsets_.end() - 1);
+  for (size_t p = 0; p < num_points_; ++p) {
+    for (size_t ap = 0; ap < macs_.size(); ++ap) {
+      if (Seen(p, ap)) {
+        owned_ap_points_[fill[ap]++] = p;
+      }
+    }
+  }
+  ap_offsets_ = owned_ap_offsets_.data();
+  ap_points_ = owned_ap_points_.data();
+}
+
+void FingerprintStore::Borrow(const FlatMap& map) {
+  auto& header = map.header();
+  macs_.clear();
+  for (size_t ap = 0; ap < header.num_aps; ++ap) {
+    macs_.push_back(map.mac(ap));
+  }
+  InternMacs();
+
+  num_points_ = header.num_points;
+  ap_stride_ = header.ap_stride;
+  mask_words_ = header.mask_words;
+  mean_ = map.Section<double>(header.mean_offset);
+  var_ = map.Section<double>(header.var_offset);
+  inv_std_ = map.Section<double>(header.inv_std_offset);
+  presence_ = map.Section<uint64_t>(header.presence_offset);
+  ap_offsets_ = map.Section<int32_t>(header.ap_offsets_offset);
+  ap_points_ = map.Section<int32_t>(header.ap_points_offset);
+
+  owned_mean_ = vector<double>();
+  owned_var_ = vector<double>();
+  owned_inv_std_ = vector<double>();
+  owned_presence_ = vector<uint64_t>();
+  owned_ap_offsets_ = vector<int>();
+  owned_ap_points_ = vector<int>();
+}
+
+int FingerprintStore::ApId(const string& mac) const {
+  auto iter = ap_ids_.find(mac);
+  if (iter == ap_ids_.end()) {
+    return -1;
+  }
+  return iter->second;
+}
+
+InternedScan FingerprintStore::Intern(const vector<Result>& scan) const {
+  InternedScan interned;
+  interned.ap.reserve(scan.size());
+  interned.signal.reserve(scan.size());
+  for (auto& result : scan) {
+    string name = result.name;
+    transform(name.begin(), name.end(), name.begin(), ::tolower);
+    int ap = ApId(name);
+    if (ap < 0) {
+      continue;
+    }
+    interned.ap.push_back(ap);
+    // Map::Stats has always compared whole signal units.
+    interned.signal.push_back((int)result.signal);
+  }
+  return interned;
+}
+
+void FingerprintStore::CountSharedAps(const InternedScan& scan,
+    vector<int>& counts) const {
+  for (int ap : scan.ap) {
+    for (auto p = points_begin(ap); p != points_end(ap); ++p) {
+      counts[*p] += 1;
+    }
+  }
+}
+
+void FingerprintStore::ClearSharedAps(const InternedScan& scan,
+    vector<int>& counts) const {
+  for (int ap : scan.ap) {
+    for (auto p = points_begin(ap); p != points_end(ap); ++p) {
+      counts[*p] = 0;
+    }
+  }
+}
+
+}
@@ -0,0 +1,115 @@
+#ifndef FINGERPRINT_STORE_H
+#define FINGERPRINT_STORE_H
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "common_utils.h"
+#include "point.h"
+#include "scan_result.h"
+
+namespace wins {
+
+class FlatMap;
+
+// A scan with every MAC resolved to its dense AP id. MACs that no point in
+// the map has seen are dropped, they can never contribute to a match.
+struct InternedScan {
+  vector<int> ap;
+  vector<double> signal;
+
+  size_t size() const { return ap.size(); }
+};
+
+// Structure-of-arrays copy of the radio map. Every point owns one row of
+// num_aps() entries (padded to ap_stride()) in the mean, variance and inverse
+// standard deviation matrices, plus a row of presence bits telling which APs
+// were ever seen there. Rows are indexed by Point::id.
+//
+// The arrays are either built from the points and owned by the store, or
+// borrowed from a memory mapped flat map that must outlive the store's use.
+class FingerprintStore {
+ private:
+  vector<string> macs_;
+  unordered_map<string, int> ap_ids_;
+  size_t num_points_ = 0;
+  size_t ap_stride_ = 0;
+  size_t mask_words_ = 0;
+  const double* mean_ = nullptr;
+  const double* var_ = nullptr;
+  const double* inv_std_ = nullptr;
+  const uint64_t* presence_ = nullptr;
+  // Inverted index, the points that have seen AP a are
+  // ap_points_[ap_offsets_[a]] up to ap_points_[ap_offsets_[a + 1]].
+  const int* ap_offsets_ = nullptr;
+  const int* ap_points_ = nullptr;
+
+  // Storage behind the arrays above when they are not borrowed.
+  vector<double> owned_mean_;
+  vector<double> owned_var_;
+  vector<double> owned_inv_std_;
+  vector<uint64_t> owned_presence_;
+  vector<int> owned_ap_offsets_;
+  vector<int> owned_ap_points_;
+
+  void InternMacs();
+
+ public:
+  // Interns every MAC in the map and assigns Point::id to each point in the
+  // order given.
+  void Build(const vector<unique_ptr<Point>>& points);
+  // Uses the arrays of a flat map in place. Point ids are the flat map's
+  // point indices.
+  void Borrow(const FlatMap& map);
+
+  // Returns -1 if the MAC is not part of the map.
+  int ApId(const string& mac) const;
+  InternedScan Intern(const vector<Result>& scan) const;
+
+  size_t num_points() const { return num_points_; }
+  size_t num_aps() const { return macs_.size(); }
+  size_t ap_stride() const { return ap_stride_; }
+  size_t mask_words() const { return mask_words_; }
+  const string& mac(int ap) const { return macs_[ap]; }
+  size_t num_postings() const { return ap_offsets_[num_aps()]; }
+
+  const double* mean_row(int point) const {
+    return &mean_[point * ap_stride_];
+  }
+  const double* var_row(int point) const {
+    return &var_[point * ap_stride_];
+  }
+  const double* inv_std_row(int point) const {
+    return &inv_std_[point * ap_stride_];
+  }
+  const uint64_t* presence_row(int point) const {
+    return &presence_[point * mask_words_];
+  }
+
+  // The inverted index as a whole, num_aps() + 1 offsets into the postings
+  // that start at points_begin(0).
+  const int* ap_offsets() const { return ap_offsets_; }
+  const int* points_begin(int ap) const {
+    return ap_points_ + ap_offsets_[ap];
+  }
+  const int* points_end(int ap) const {
+    return ap_points_ + ap_offsets_[ap + 1];
+  }
+
+  // Adds one to counts[p] for every AP of the scan that point p has seen,
+  // touching only the points that share an AP with the scan. counts must
+  // hold num_points() entries. ClearSharedAps undoes it in the same time.
+  void CountSharedAps(const InternedScan& scan, vector<int>& counts) const;
+  void ClearSharedAps(const InternedScan& scan, vector<int>& counts) const;
+
+  static bool Seen(const uint64_t* presence, int ap) {
+    return (presence[ap >> 6] >> (ap & 63)) & 1;
+  }
+  bool Seen(int point, int ap) const {
+    return Seen(presence_row(point), ap);
+  }
+};
+
+}
+
+#endif // FINGERPRINT_STORE_H
@@ -0,0 +1,193 @@
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flat_map.h"
+
+namespace wins {
+
+using namespace std;
+
+#define FLAT_MAP_BYTE_ORDER 0x01020304
+
+namespace {
+  uint64_t Align(uint64_t offset) {
+    return (offset + FLAT_MAP_ALIGN - 1) / FLAT_MAP_ALIGN * FLAT_MAP_ALIGN;
+  }
+
+  struct SectionData {
+    uint64_t* offset;
+    const void* data;
+    size_t bytes;
+  };
+} // anonymous namespace
+
+FlatMap::FlatMap(const string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw runtime_error("Map file does not exist");
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 or (size_t)st.st_size < sizeof(FlatMapHeader)) {
+    close(fd);
+    throw runtime_error("Map file is too short");
+  }
+  size_ = st.st_size;
+  void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw runtime_error("Could not map the map file");
+  }
+  data_ = static_cast<const char*>(data);
+
+  auto& h = header();
+  auto fits = [this](uint64_t offset, uint64_t count, uint64_t size) {
+    return offset % FLAT_MAP_ALIGN == 0 and offset <= size_ and
+        count <= (size_ - offset) / size;
+  };
+  uint64_t cells = h.num_points * h.ap_stride;
+  bool valid = memcmp(h.magic, FLAT_MAP_MAGIC, sizeof(FLAT_MAP_MAGIC)) == 0 and
+      h.version == FLAT_MAP_VERSION and
+      h.byte_order == FLAT_MAP_BYTE_ORDER and
+      h.file_size == size_ and
+      h.ap_stride >= h.num_aps and
+      fits(h.mac_offsets_offset, h.num_aps + 1, sizeof(uint32_t)) and
+      fits(h.x_offset, h.num_points, sizeof(double)) and
+      fits(h.y_offset, h.num_points, sizeof(double)) and
+      fits(h.scale_x_offset, h.num_points, sizeof(double)) and
+      fits(h.scale_y_offset, h.num_points, sizeof(double)) and
+      fits(h.mean_offset, cells, sizeof(double)) and
+      fits(h.var_offset, cells, sizeof(double)) and
+      fits(h.inv_std_offset, cells, sizeof(double)) and
+      fits(h.presence_offset, h.num_points * h.mask_words,
+          sizeof(uint64_t)) and
+      fits(h.ap_offsets_offset, h.num_aps + 1, sizeof(int32_t)) and
+      fits(h.ap_points_offset, h.num_postings, sizeof(int32_t)) and
+      fits(h.mac_chars_offset,
+          Section<uint32_t>(h.mac_offsets_offset)[h.num_aps], 1);
+  if (not valid) {
+    munmap(const_cast<char*>(data_), size_);
+    throw runtime_error("Not a flat map of version " +
+        to_string(FLAT_MAP_VERSION));
+  }
+}
+
+FlatMap::~FlatMap() {
+  munmap(const_cast<char*>(data_), size_);
+}
+
+bool FlatMap::IsFlatMap(const string& filename) {
+  char magic[sizeof(FLAT_MAP_MAGIC)] = {};
+  ifstream is(filename, ios::binary);
+  is.read(magic, sizeof(magic));
+  return is and memcmp(magic, FLAT_MAP_MAGIC, sizeof(magic)) == 0;
+}
+
+void FlatMap::Write(const string& filename,
+    const vector<unique_ptr<Point>>& points,
+    const FingerprintStore& fingerprints) {
+  FlatMapHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FLAT_MAP_MAGIC, sizeof(FLAT_MAP_MAGIC));
+  header.version = FLAT_MAP_VERSION;
+  header.byte_order = FLAT_MAP_BYTE_ORDER;
+  header.num_points = fingerprints.num_points();
+  header.num_aps = fingerprints.num_aps();
+  header.ap_stride = fingerprints.ap_stride();
+  header.mask_words = fingerprints.mask_words();
+  header.num_postings = fingerprints.num_postings();
+
+  vector<uint32_t> mac_offsets;
+  string mac_chars;
+  for (size_t ap = 0; ap < header.num_aps; ++ap) {
+    mac_offsets.push_back(mac_chars.size());
+    mac_chars += fingerprints.mac(ap);
+  }
+  mac_offsets.push_back(mac_chars.size());
+
+  // Points are stored by id, whatever order the caller holds them in.
+  vector<double> x(header.num_points);
+  vector<double> y(header.num_points);
+  vector<double> scale_x(header.num_points);
+  vector<double> scale_y(header.num_points);
+  for (auto& point : points) {
+    x[point->id] = point->x;
+    y[point->id] = point->y;
+    scale_x[point->id] = point->scale_x;
+    scale_y[point->id] = point->scale_y;
+  }
+
+  size_t cells = header.num_points * header.ap_stride * sizeof(double);
+  vector<SectionData> sections = {
+    { &header.mac_offsets_offset, mac_offsets.data(),
+      mac_offsets.size() * sizeof(uint32_t) },
+    { &header.mac_chars_offset, mac_chars.data(), mac_chars.size() },
+    { &header.x_offset, x.data(), x.size() * sizeof(double) },
+    { &header.y_offset, y.data(), y.size() * sizeof(double) },
+    { &header.scale_x_offset, scale_x.data(), scale_x.size() * sizeof(double) },
+    { &header.scale_y_offset, scale_y.data(), scale_y.size() * sizeof(double) },
+    { &header.mean_offset, fingerprints.mean_row(0), cells },
+    { &header.var_offset, fingerprints.var_row(0), cells },
+    { &header.inv_std_offset, fingerprints.inv_std_row(0), cells },
+    { &header.presence_offset, fingerprints.presence_row(0),
+      header.num_points * header.mask_words * sizeof(uint64_t) },
+    { &header.ap_offsets_offset, fingerprints.ap_offsets(),
+      (header.num_aps + 1) * sizeof(int32_t) },
+    { &header.ap_points_offset, fingerprints.points_begin(0),
+      header.num_postings * sizeof(int32_t) },
+  };
+
+  uint64_t offset = Align(sizeof(header));
+  for (auto& section : sections) {
+    *section.offset = offset;
+    offset = Align(offset + section.bytes);
+  }
+  header.file_size = offset;
+
+  ofstream os(filename, ios::binary);
+  const char padding[FLAT_MAP_ALIGN] = {};
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  uint64_t written = sizeof(header);
+  for (auto& section : sections) {
+    os.write(padding, *section.offset - written);
+    os.write(static_cast<const char*>(section.data), section.bytes);
+    written = *section.offset + section.bytes;
+  }
+  os.write(padding, header.file_size - written);
+  if (not os) {
+    throw runtime_error("Could not write " + filename);
+  }
+}
+
+string FlatMap::mac(size_t ap) const {
+  auto& h = header();
+  auto offsets = Section<uint32_t>(h.mac_offsets_offset);
+  return string(Section<char>(h.mac_chars_offset) + offsets[ap],
+      offsets[ap + 1] - offsets[ap]);
+}
+
+vector<unique_ptr<Point>> FlatMap::Points() const {
+  auto& h = header();
+  auto x = Section<double>(h.x_offset);
+  auto y = Section<double>(h.y_offset);
+  auto scale_x = Section<double>(h.scale_x_offset);
+  auto scale_y = Section<double>(h.scale_y_offset);
+  vector<unique_ptr<Point>> points;
+  points.reserve(h.num_points);
+  for (size_t i = 0; i < h.num_points; ++i) {
+    unique_ptr<Point> point(new Point());
+    point->x = x[i];
+    point->y = y[i];
+    point->scale_x = scale_x[i];
+    point->scale_y = scale_y[i];
+    point->id = i;
+    points.push_back(move(point));
+  }
+  return points;
+}
+
+}
@@ -0,0 +1,93 @@
+#ifndef FLAT_MAP_H
+#define FLAT_MAP_H
+
+#include <cstdint>
+
+#include "common_utils.h"
+#include "fingerprint_store.h"
+#include "point.h"
+
+namespace wins {
+
+#define FLAT_MAP_MAGIC "WINSMAP"
+#define FLAT_MAP_VERSION 1
+// Every section starts on this boundary, relative to the start of the file.
+#define FLAT_MAP_ALIGN 64
+
+// Layout of a flat map file. Sections are stored in native byte order, which
+// byte_order records, and are found through the byte offsets below:
+//
+//   mac_offsets  uint32_t[num_aps + 1]  where each MAC starts in mac_chars
+//   mac_chars    char[]                 the MACs back to back, sorted
+//   x, y         double[num_points]     point coordinates
+//   scale_x/y    double[num_points]
+//   mean, var    double[num_points * ap_stride]  FingerprintStore rows
+//   inv_std      double[num_points * ap_stride]
+//   presence     uint64_t[num_points * mask_words]
+//   ap_offsets   int32_t[num_aps + 1]   FingerprintStore inverted index
+//   ap_points    int32_t[num_postings]
+//
+// Point i of the file has Point::id i. Point::cost and the raw scans are not
+// stored, the runtime does not use them.
+struct FlatMapHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t file_size;
+  uint64_t num_points;
+  uint64_t num_aps;
+  uint64_t ap_stride;
+  uint64_t mask_words;
+  uint64_t num_postings;
+  uint64_t mac_offsets_offset;
+  uint64_t mac_chars_offset;
+  uint64_t x_offset;
+  uint64_t y_offset;
+  uint64_t scale_x_offset;
+  uint64_t scale_y_offset;
+  uint64_t mean_offset;
+  uint64_t var_offset;
+  uint64_t inv_std_offset;
+  uint64_t presence_offset;
+  uint64_t ap_offsets_offset;
+  uint64_t ap_points_offset;
+};
+
+// A flat map file mapped read-only into memory. Nothing is copied on load,
+// pages are faulted in as the sections are first touched.
+class FlatMap {
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+
+  FlatMap(FlatMap const&) = delete;
+  void operator=(FlatMap const&) = delete;
+
+ public:
+  // Throws runtime_error if the file cannot be mapped or is not a flat map
+  // of this version.
+  explicit FlatMap(const string& filename);
+  ~FlatMap();
+
+  // Only looks at the magic bytes.
+  static bool IsFlatMap(const string& filename);
+  static void Write(const string& filename,
+      const vector<unique_ptr<Point>>& points,
+      const FingerprintStore& fingerprints);
+
+  const FlatMapHeader& header() const {
+    return *reinterpret_cast<const FlatMapHeader*>(data_);
+  }
+  template <typename T>
+  const T* Section(uint64_t offset) const {
+    return reinterpret_cast<const T*>(data_ + offset);
+  }
+  string mac(size_t ap) const;
+  // Creates the points of the map, without fingerprints, with Point::id set
+  // to their index in the file.
+  vector<unique_ptr<Point>> Points() const;
+};
+
+}
+
+#endif // FLAT_MAP_H
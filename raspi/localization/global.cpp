@@ -18,6 +18,7 @@ using namespace std;
 
 string Global::MapFile = "/home/pi/wins/raspi/localization/data/"
     "ee_ab_map_8lin.dat";
+MapIndex Global::MapIndexKind = MAP_INDEX_GRID;
 
 WinsEvent Global::event_flags_;
 condition_variable Global::display_event_pending_;
@@ -22,6 +22,14 @@ enum WiFiVariant {
   All                    = 010,
 };
 
+// Spatial index used for nearest node and neighbor queries on the map.
+enum MapIndex {
+  MAP_INDEX_KDTREE,
+  // A GridIndex if the map lies on the integer lattice, the kd-tree
+  // otherwise.
+  MAP_INDEX_GRID,
+};
+
 enum WinsEvent {
   WINS_EVENT_NONE               = 00,
   WINS_EVENT_POS_CHANGE         = 01,
@@ -69,6 +77,7 @@ class Global {
   static bool NoSleep;
   static int DurationOverride;
   static string MapFile;
+  static MapIndex MapIndexKind;
   static vector<string> WiFiDevices;
   static int InitWiFiReadings;
   static int ReadingsPerUpdate;
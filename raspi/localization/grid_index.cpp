@@ -0,0 +1,113 @@
+#include <cmath>
+
+#include "grid_index.h"
+
+namespace wins {
+
+// Coordinates beyond this are not treated as lattice points, which keeps the
+// cell arithmetic within int.
+#define GRID_MAX_COORD (1 << 20)
+
+namespace {
+  bool OnLattice(double v) {
+    return v == floor(v) and fabs(v) <= GRID_MAX_COORD;
+  }
+} // anonymous namespace
+
+unique_ptr<GridIndex> GridIndex::TryBuild(kdtree::kdtree<Point*>& tree) {
+  if (tree.size() == 0) {
+    return nullptr;
+  }
+  int min_x = GRID_MAX_COORD;
+  int min_y = GRID_MAX_COORD;
+  int max_x = -GRID_MAX_COORD;
+  int max_y = -GRID_MAX_COORD;
+  for (size_t i = 0; i < tree.size(); ++i) {
+    auto node = tree.at(i);
+    if (not OnLattice(node->x) or not OnLattice(node->y)) {
+      return nullptr;
+    }
+    min_x = min(min_x, (int)node->x);
+    min_y = min(min_y, (int)node->y);
+    max_x = max(max_x, (int)node->x);
+    max_y = max(max_y, (int)node->y);
+  }
+  double cells = (double)(max_x - min_x + 1) * (max_y - min_y + 1);
+  if (tree.size() < GRID_MIN_FILL * cells) {
+    return nullptr;
+  }
+
+  unique_ptr<GridIndex> grid(new GridIndex());
+  grid->min_x_ = min_x;
+  grid->min_y_ = min_y;
+  grid->width_ = max_x - min_x + 1;
+  grid->height_ = max_y - min_y + 1;
+  auto cell = [&grid](const Node* node) {
+    return ((int)node->y - grid->min_y_) * grid->width_ +
+        (int)node->x - grid->min_x_;
+  };
+
+  // Bucket the nodes by cell, keeping tree order within a cell.
+  grid->cell_offsets_.assign(grid->width_ * grid->height_ + 1, 0);
+  for (size_t i = 0; i < tree.size(); ++i) {
+    grid->cell_offsets_[cell(tree.at(i)) + 1] += 1;
+  }
+  for (size_t c = 1; c < grid->cell_offsets_.size(); ++c) {
+    grid->cell_offsets_[c] += grid->cell_offsets_[c - 1];
+  }
+  grid->cell_nodes_.resize(tree.size());
+  vector<int32_t> fill(grid->cell_offsets_.begin(),
+      grid->cell_offsets_.end() - 1);
+  for (size_t i = 0; i < tree.size(); ++i) {
+    auto node = tree.at(i);
+    grid->cell_nodes_[fill[cell(node)]++] = node;
+  }
+  return grid;
+}
+
+GridIndex::Node* GridIndex::Nearest(double x, double y) const {
+  // Every other lattice point is at least as far as the one (x, y) rounds
+  // to, so an occupied cell holds the nearest node.
+  double cx = floor(x + 0.5) - min_x_;
+  double cy = floor(y + 0.5) - min_y_;
+  if (not (cx >= 0 and cx < width_ and cy >= 0 and cy < height_)) {
+    return nullptr;
+  }
+  int c = (int)cy * width_ + (int)cx;
+  if (cell_offsets_[c] == cell_offsets_[c + 1]) {
+    return nullptr;
+  }
+  return cell_nodes_[cell_offsets_[c]];
+}
+
+void GridIndex::RadiusNearest(double x, double y, double radius,
+    vector<Node*>& nodes, bool sorted) const {
+  size_t first = nodes.size();
+  // Clamp in double, the radius may be far larger than the grid.
+  int x0 = (int)max(0.0, ceil(x - radius) - min_x_);
+  int x1 = (int)min(width_ - 1.0, floor(x + radius) - min_x_);
+  int y0 = (int)max(0.0, ceil(y - radius) - min_y_);
+  int y1 = (int)min(height_ - 1.0, floor(y + radius) - min_y_);
+  double r2 = radius * radius;
+  for (int cy = y0; cy <= y1; ++cy) {
+    for (int cx = x0; cx <= x1; ++cx) {
+      int c = cy * width_ + cx;
+      for (int i = cell_offsets_[c]; i < cell_offsets_[c + 1]; ++i) {
+        if (cell_nodes_[i]->distance2(x, y) <= r2) {
+          nodes.push_back(cell_nodes_[i]);
+        }
+      }
+    }
+  }
+  if (sorted) {
+    // The order of kdtree::radius_nearest, closest first and then by place
+    // in the tree.
+    sort(nodes.begin() + first, nodes.end(), [x, y](Node* a, Node* b) {
+      double da = a->distance2(x, y);
+      double db = b->distance2(x, y);
+      return da < db or (da == db and a < b);
+    });
+  }
+}
+
+}
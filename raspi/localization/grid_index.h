@@ -0,0 +1,58 @@
+#ifndef GRID_INDEX_H
+#define GRID_INDEX_H
+
+#include <cstdint>
+
+#include "common_utils.h"
+#include "kdtree/kdtree.hpp"
+#include "point.h"
+
+namespace wins {
+
+// A map that leaves more of its bounding box empty than this is not treated
+// as a lattice. It also bounds the cells to 1 / GRID_MIN_FILL per point.
+#define GRID_MIN_FILL 0.05
+
+// A bucketed grid over the nodes of a kd-tree, for maps whose points sit on
+// the integer lattice, as surveyed maps do. A cell is one lattice point, so
+// the nearest node is found by rounding, and a radius query only visits the
+// cells that overlap its circle. The grid points into the kd-tree's nodes and
+// must not outlive the tree.
+class GridIndex {
+ private:
+  using Node = kdtree::node<Point*>;
+
+  int min_x_ = 0;
+  int min_y_ = 0;
+  int width_ = 0;
+  int height_ = 0;
+  // The nodes of cell c are cell_nodes_[cell_offsets_[c], cell_offsets_[c + 1])
+  // with c = (y - min_y_) * width_ + x - min_x_.
+  vector<int32_t> cell_offsets_;
+  vector<Node*> cell_nodes_;
+
+  GridIndex() {}
+  GridIndex(GridIndex const&) = delete;
+  void operator=(GridIndex const&) = delete;
+
+ public:
+  // Returns null when a point is off the integer lattice or the points fill
+  // less than GRID_MIN_FILL of their bounding box, in which case the kd-tree
+  // should be searched instead.
+  static unique_ptr<GridIndex> TryBuild(kdtree::kdtree<Point*>& tree);
+
+  // The node nearest to (x, y), or null when (x, y) does not round to an
+  // occupied cell. Nodes at the same distance may be picked differently
+  // from kdtree::nearest.
+  Node* Nearest(double x, double y) const;
+  // Appends the nodes within radius of (x, y) to nodes. Sorted, they come in
+  // the same order as from kdtree::radius_nearest.
+  void RadiusNearest(double x, double y, double radius, vector<Node*>& nodes,
+      bool sorted = true) const;
+
+  size_t num_cells() const { return cell_offsets_.size() - 1; }
+};
+
+}
+
+#endif // GRID_INDEX_H
@@ -39,12 +39,12 @@ namespace {
   }
 }
 
-MatrixXd Imu::X(SVARS, 1);
-MatrixXd Imu::P(SVARS, SVARS);
-MatrixXd Imu::R(SVARS, SVARS);
-MatrixXd Imu::Q(SVARS, SVARS);
-MatrixXd Imu::H(SVARS, SVARS);
-MatrixXd Imu::H_t(SVARS, SVARS);
+Matrix<double, SVARS, 1> Imu::X;
+Matrix<double, SVARS, SVARS> Imu::P;
+Matrix<double, SVARS, SVARS> Imu::R;
+Matrix<double, SVARS, SVARS> Imu::Q;
+Matrix<double, SVARS, SVARS> Imu::H;
+Matrix<double, SVARS, SVARS> Imu::H_t;
 
 vector<double> Imu::current_state;
 vector<double> Imu::current_variance;
@@ -67,18 +67,18 @@ void Imu::Init() {
   H_t = H.transpose();
 
   X.setZero();
-  P = HIGH_VARIANCE * MatrixXd::Identity(SVARS, SVARS);
+  P = HIGH_VARIANCE * Matrix<double, SVARS, SVARS>::Identity();
 
   // Velocity is zero at start.
   P(2,2) = 0;
   P(3,3) = 0;
 
-  Q.block<2,2>(0,0) = MatrixXd::Identity(2,2) * Global::IMU_QD;
-  R.block<2,2>(0,0) = MatrixXd::Identity(2,2) * Global::IMU_R * Global::IMU_QD;
-  Q.block<2,2>(2,2) = MatrixXd::Identity(2,2) * Global::IMU_QV;
-  R.block<2,2>(4,4) = MatrixXd::Identity(2,2) * Global::IMU_R * Global::IMU_QV;
-  Q.block<2,2>(4,4) = MatrixXd::Identity(2,2) * Global::IMU_QA;
-  R.block<2,2>(4,4) = MatrixXd::Identity(2,2) * Global::IMU_R * Global::IMU_QA;
+  Q.block<2,2>(0,0) = Matrix2d::Identity() * Global::IMU_QD;
+  R.block<2,2>(0,0) = Matrix2d::Identity() * Global::IMU_R * Global::IMU_QD;
+  Q.block<2,2>(2,2) = Matrix2d::Identity() * Global::IMU_QV;
+  R.block<2,2>(4,4) = Matrix2d::Identity() * Global::IMU_R * Global::IMU_QV;
+  Q.block<2,2>(4,4) = Matrix2d::Identity() * Global::IMU_QA;
+  R.block<2,2>(4,4) = Matrix2d::Identity() * Global::IMU_R * Global::IMU_QA;
 }
 
 void Imu::AddReading(double ax, double ay, double az,
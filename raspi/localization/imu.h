@@ -26,11 +26,13 @@ struct ImuResult {
 
 class Imu{
  private:
-  static Eigen::MatrixXd R;  // Estimated sensor
-  static Eigen::MatrixXd Q;  // Estimated process error covariance.
+  // Estimated sensor error covariance.
+  static Eigen::Matrix<double, SVARS, SVARS> R;
+  // Estimated process error covariance.
+  static Eigen::Matrix<double, SVARS, SVARS> Q;
 
-  static Eigen::MatrixXd H;
-  static Eigen::MatrixXd H_t;
+  static Eigen::Matrix<double, SVARS, SVARS> H;
+  static Eigen::Matrix<double, SVARS, SVARS> H_t;
 
   static vector<double> current_state;
   static vector<double> current_variance;
@@ -44,8 +46,8 @@ class Imu{
   static double initial_yaw_;
 
  public:
-  static Eigen::MatrixXd X;      // Current state estimate.
-  static Eigen::MatrixXd P;  // Current covariance estimate.
+  static Eigen::Matrix<double, SVARS, 1> X;      // Current state estimate.
+  static Eigen::Matrix<double, SVARS, SVARS> P;  // Current covariance.
 
   static void AddReading(double ax, double ay, double az,
       double qw, double qx, double qy, double qz);
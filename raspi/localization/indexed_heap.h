@@ -0,0 +1,125 @@
+#ifndef INDEXED_HEAP_H
+#define INDEXED_HEAP_H
+
+#include <cstdint>
+
+#include "common_utils.h"
+
+namespace wins {
+
+// Binary min-heap of node numbers in [0, num_nodes), each with a key. The
+// position of every node in the heap is kept in an array indexed by node
+// number, so the key of a node already on the heap can be changed, and the
+// node removed, in logarithmic time.
+template <typename Key>
+class IndexedHeap {
+ private:
+  // Position of a node in heap_, or -1 when it is not on it.
+  vector<int32_t> pos_;
+  vector<Key> key_;
+  vector<int32_t> heap_;
+
+  void Place(size_t pos, int32_t node) {
+    heap_[pos] = node;
+    pos_[node] = pos;
+  }
+
+  void SiftUp(size_t pos) {
+    int32_t node = heap_[pos];
+    while (pos > 0) {
+      size_t parent = (pos - 1) / 2;
+      if (not (key_[node] < key_[heap_[parent]])) {
+        break;
+      }
+      Place(pos, heap_[parent]);
+      pos = parent;
+    }
+    Place(pos, node);
+  }
+
+  void SiftDown(size_t pos) {
+    int32_t node = heap_[pos];
+    while (true) {
+      size_t child = 2 * pos + 1;
+      if (child >= heap_.size()) {
+        break;
+      }
+      if (child + 1 < heap_.size() and
+          key_[heap_[child + 1]] < key_[heap_[child]]) {
+        child += 1;
+      }
+      if (not (key_[heap_[child]] < key_[node])) {
+        break;
+      }
+      Place(pos, heap_[child]);
+      pos = child;
+    }
+    Place(pos, node);
+  }
+
+ public:
+  // Empties the heap and makes room for num_nodes nodes.
+  void Resize(size_t num_nodes) {
+    heap_.clear();
+    pos_.assign(num_nodes, -1);
+    key_.resize(num_nodes);
+    heap_.reserve(num_nodes);
+  }
+
+  // Empties the heap in time proportional to its size.
+  void Clear() {
+    for (auto node : heap_) {
+      pos_[node] = -1;
+    }
+    heap_.clear();
+  }
+
+  size_t num_nodes() const { return pos_.size(); }
+  bool empty() const { return heap_.empty(); }
+  bool Contains(int32_t node) const { return pos_[node] >= 0; }
+  int32_t Top() const { return heap_.front(); }
+  const Key& TopKey() const { return key_[heap_.front()]; }
+
+  // Adds node with key, or changes its key if it is on the heap already.
+  void Push(int32_t node, const Key& key) {
+    if (Contains(node)) {
+      bool lower = key < key_[node];
+      key_[node] = key;
+      if (lower) {
+        SiftUp(pos_[node]);
+      } else {
+        SiftDown(pos_[node]);
+      }
+      return;
+    }
+    key_[node] = key;
+    heap_.push_back(node);
+    SiftUp(heap_.size() - 1);
+  }
+
+  int32_t Pop() {
+    int32_t top = heap_.front();
+    Remove(top);
+    return top;
+  }
+
+  void Remove(int32_t node) {
+    size_t pos = pos_[node];
+    pos_[node] = -1;
+    int32_t last = heap_.back();
+    heap_.pop_back();
+    if (pos == heap_.size()) {
+      return;
+    }
+    heap_[pos] = last;
+    if (pos > 0 and key_[last] < key_[heap_[(pos - 1) / 2]]) {
+      SiftUp(pos);
+    } else {
+      SiftDown(pos);
+    }
+  }
+};
+
+}
+
+#endif // INDEXED_HEAP_H
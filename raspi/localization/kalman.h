@@ -5,16 +5,71 @@
 
 namespace wins {
 
+// A linear Kalman filter step on a state of StateDim values and a
+// measurement of MeasDim values. The sizes are fixed at compile time so
+// that a step does not allocate. Imu has a state of SVARS values, Location
+// one of the 2 of the position.
+
+// Moves the state X and its covariance P on by the state transition A.
+template <int StateDim>
+void KalmanPredict(
+    Eigen::Matrix<double, StateDim, 1>& X,
+    Eigen::Matrix<double, StateDim, StateDim>& P,
+    const Eigen::Matrix<double, StateDim, StateDim>& A,
+    const Eigen::Matrix<double, StateDim, StateDim>& A_t,
+    const Eigen::Matrix<double, StateDim, StateDim>& Q) {
+  // State prediction.
+  X = A * X;
+
+  // Covariance prediction.
+  P = A * P * A_t + Q;
+}
+
+// Corrects X and P by the measurement Z = H * X, with noise covariance R.
+// Independent measurements of the same state can be corrected by one after
+// the other.
+template <int StateDim, int MeasDim>
+void KalmanCorrect(
+    Eigen::Matrix<double, StateDim, 1>& X,
+    Eigen::Matrix<double, StateDim, StateDim>& P,
+    const Eigen::Matrix<double, MeasDim, 1>& Z,
+    const Eigen::Matrix<double, MeasDim, StateDim>& H,
+    const Eigen::Matrix<double, StateDim, MeasDim>& H_t,
+    const Eigen::Matrix<double, MeasDim, MeasDim>& R) {
+  // Innovation.
+  Eigen::Matrix<double, MeasDim, 1> Y = Z - H * X;
+
+  // Innovaion covariance.
+  Eigen::Matrix<double, MeasDim, MeasDim> I = H * P * H_t + R;
+
+  // Kalman gain, K = P * H_t * I^-1. Both P and I are symmetric, so its
+  // transpose solves I * K_t = H * P, which is cheaper and steadier than
+  // inverting I.
+  Eigen::Matrix<double, MeasDim, StateDim> K_t = I.ldlt().solve(H * P);
+
+  // State update.
+  X += K_t.transpose() * Y;
+
+  // Covariance update.
+  P = (Eigen::Matrix<double, StateDim, StateDim>::Identity() -
+      K_t.transpose() * H) * P;
+}
+
+// A prediction and then a correction.
+template <int StateDim, int MeasDim>
 void KalmanUpdate(
-    Eigen::MatrixXd& X,
-    Eigen::MatrixXd& P,
-    const Eigen::MatrixXd& Z,
-    const Eigen::MatrixXd& A,
-    const Eigen::MatrixXd& A_t,
-    const Eigen::MatrixXd& H,
-    const Eigen::MatrixXd& H_t,
-    const Eigen::MatrixXd& R,
-    const Eigen::MatrixXd& Q);
+    Eigen::Matrix<double, StateDim, 1>& X,
+    Eigen::Matrix<double, StateDim, StateDim>& P,
+    const Eigen::Matrix<double, MeasDim, 1>& Z,
+    const Eigen::Matrix<double, StateDim, StateDim>& A,
+    const Eigen::Matrix<double, StateDim, StateDim>& A_t,
+    const Eigen::Matrix<double, MeasDim, StateDim>& H,
+    const Eigen::Matrix<double, StateDim, MeasDim>& H_t,
+    const Eigen::Matrix<double, MeasDim, MeasDim>& R,
+    const Eigen::Matrix<double, StateDim, StateDim>& Q) {
+  KalmanPredict<StateDim>(X, P, A, A_t, Q);
+  KalmanCorrect<StateDim, MeasDim>(X, P, Z, H, H_t, R);
+}
 
 }
 
@@ -9,55 +9,361 @@
 #ifndef __kdtree__kdtree__
 #define __kdtree__kdtree__
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <utility>
+#include <vector>
+
 #include "node.hpp"
 
 namespace kdtree {
+    /**
+     *  Runs body(i) for every i in [0, count), possibly at the same time on
+     *  other threads, and returns once all of them have run.
+     */
+    typedef std::function<void(size_t, const std::function<void(size_t)>&)> runner;
+
+    /**
+     *  Subtrees of at least this many points are built through the runner.
+     */
+    const int parallel_build_cutoff = 1 << 13;
+
+    /**
+     *  Batch queries are handed to the runner in chunks of this many.
+     */
+    const size_t batch_chunk_size = 256;
+
+    /**
+     *  Interleave the bits of two 16 bit coordinates into a Morton (Z-order)
+     *  code, x taking the even bits.
+     */
+    inline uint32_t morton_code(uint32_t x, uint32_t y) {
+        auto spread = [](uint32_t v) {
+            v &= 0xffff;
+            v = (v | (v << 8)) & 0x00ff00ff;
+            v = (v | (v << 4)) & 0x0f0f0f0f;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    /**
+     *  A 2-d tree over points with x and y members. All nodes are kept in a
+     *  single vector that is sized once on construction, so node pointers
+     *  handed out by the searches stay valid for the life of the tree.
+     */
     template <typename T>
     class kdtree {
-    public:
-        node<T> *root;
+    private:
+        std::vector<node<T>> nodes_;
+
+        kdtree(kdtree const&) = delete;
+        void operator=(kdtree const&) = delete;
+
+        /**
+         *  Where the build places a point, before the nodes are created.
+         */
+        template <typename U>
+        struct slot {
+            const U *point;
+            int32_t left;
+            int32_t right;
+        };
+
+        /**
+         *  Build the subtree of points[0, size) into slots[index, index + size).
+         *  The subtree of a range always takes the same slots, so the two
+         *  halves can be built independently of each other.
+         */
+        template <typename U>
+        void build(std::vector<slot<U>>& slots, const U **points, int size, int depth, int32_t index, const runner& run) {
+            // Move the median to the middle, with no greater point before it and no smaller point after it
+            int median = size / 2;
+            bool is_even = !(depth & 1);
+            if (is_even) {
+                std::nth_element(points, points + median, points + size, [](const U *a, const U *b) { return deref(*a).x < deref(*b).x; });
+            } else {
+                std::nth_element(points, points + median, points + size, [](const U *a, const U *b) { return deref(*a).y < deref(*b).y; });
+            }
+
+            // The left subtree directly follows, then the right subtree
+            int left_size = median;
+            int right_size = size - median - 1;
+            slots[index].point = points[median];
+            slots[index].left = left_size > 0 ? index + 1 : -1;
+            slots[index].right = right_size > 0 ? index + 1 + left_size : -1;
+
+            auto build_side = [&](size_t side) {
+                if (side == 0 && left_size > 0) {
+                    this->build(slots, points, left_size, depth + 1, index + 1, run);
+                } else if (side == 1 && right_size > 0) {
+                    this->build(slots, points + median + 1, right_size, depth + 1, index + 1 + left_size, run);
+                }
+            };
+            if (run && size >= parallel_build_cutoff) {
+                run(2, build_side);
+            } else {
+                build_side(0);
+                build_side(1);
+            }
+        }
+
+        template <typename U>
+        void init(const U *points, int size, const runner& run) {
+            std::vector<const U *> refs(size);
+            for (int i = 0; i < size; i++) {
+                refs[i] = points + i;
+            }
+            std::vector<slot<U>> slots(size);
+            if (size > 0) {
+                this->build(slots, refs.data(), size, 0, 0, run);
+            }
+
+            nodes_.reserve(size);
+            for (auto& s : slots) {
+                nodes_.emplace_back(handle(*s.point));
+                nodes_.back().left = s.left;
+                nodes_.back().right = s.right;
+            }
+        }
+
+        node<T> * closer(double qx, double qy, node<T> *a, node<T> *b) {
+            return a->distance(qx, qy) < b->distance(qx, qy) ? a : b;
+        }
+
+        node<T> * _nearest(double qx, double qy, int32_t index, const int depth) {
+            node<T> *self = &nodes_[index];
+
+            // If self is the leaf, return self
+            if (self->is_leaf()) {
+                return self;
+            }
+
+            // Calculate distance between the query and self along one direction (if depth is even, the direction is horizontal)
+            bool is_even = !(depth & 1);
+            double distance = is_even ? std::fabs(qx - self->x) : std::fabs(qy - self->y);
+
+            // Search the side of the query first, then the other side if it may hold a closer node
+            bool left = is_even ? (self->x > qx) : (self->y > qy);
+            int32_t near = left ? self->left : self->right;
+            int32_t far = left ? self->right : self->left;
+            node<T> *leaf = NULL;
+
+            if (near >= 0) {
+                leaf = this->_nearest(qx, qy, near, depth + 1);
+
+                if (far >= 0 && distance < leaf->distance(qx, qy)) {
+                    leaf = this->closer(qx, qy, leaf, this->_nearest(qx, qy, far, depth + 1));
+                }
+            } else {
+                leaf = this->_nearest(qx, qy, far, depth + 1);
+            }
+
+            return this->closer(qx, qy, self, leaf);
+        }
+
+        void _radius_nearest(std::vector<node<T> *>& neighbors, double qx, double qy, const double r, const double r2, int32_t index, const int depth) {
+            node<T> *self = &nodes_[index];
+
+            // Calculate distance between the query and self along one direction (if depth is even, the direction is horizontal)
+            bool is_even = !(depth & 1);
+            double distance = is_even ? std::fabs(qx - self->x) : std::fabs(qy - self->y);
+
+            // Find the node inside the circle with specified radius
+            bool left = is_even ? (self->x > qx) : (self->y > qy);
+            int32_t near = left ? self->left : self->right;
+            int32_t far = left ? self->right : self->left;
+
+            if (near >= 0) {
+                this->_radius_nearest(neighbors, qx, qy, r, r2, near, depth + 1);
+            }
+
+            if (far >= 0 && distance <= r) {
+                this->_radius_nearest(neighbors, qx, qy, r, r2, far, depth + 1);
+            }
+
+            if (self->distance2(qx, qy) <= r2) {
+                neighbors.push_back(self);
+            }
+        }
+
+        /**
+         *  The k-nearest search keeps neighbors[first, end) as a max-heap on
+         *  this order, so the farthest candidate is on top.
+         */
+        struct closer_to {
+            double qx;
+            double qy;
+
+            bool operator () (const node<T> *a, const node<T> *b) const {
+                double da = a->distance2(qx, qy);
+                double db = b->distance2(qx, qy);
+                return da < db || (da == db && a < b);
+            }
+        };
+
+        void _k_nearest(std::vector<node<T> *>& neighbors, size_t first, const closer_to& order, const size_t k, int32_t index, const int depth) {
+            node<T> *self = &nodes_[index];
+            double qx = order.qx;
+            double qy = order.qy;
+
+            // Calculate distance between the query and self along one direction (if depth is even, the direction is horizontal)
+            bool is_even = !(depth & 1);
+            double distance = is_even ? qx - self->x : qy - self->y;
+
+            // Find the nearest node
+            bool left = is_even ? (self->x > qx) : (self->y > qy);
+            int32_t near = left ? self->left : self->right;
+            int32_t far = left ? self->right : self->left;
+
+            if (near >= 0) {
+                this->_k_nearest(neighbors, first, order, k, near, depth + 1);
+            }
+
+            // The other side can only help while the heap is not full or the
+            // split is no farther than the farthest candidate, which keeps
+            // the result exact on ties
+            if (far >= 0 && (neighbors.size() - first < k ||
+                    distance * distance <= neighbors[first]->distance2(qx, qy))) {
+                this->_k_nearest(neighbors, first, order, k, far, depth + 1);
+            }
+
+            if (neighbors.size() - first < k) {
+                neighbors.push_back(self);
+                std::push_heap(neighbors.begin() + first, neighbors.end(), order);
+            } else if (order(self, neighbors[first])) {
+                std::pop_heap(neighbors.begin() + first, neighbors.end(), order);
+                neighbors.back() = self;
+                std::push_heap(neighbors.begin() + first, neighbors.end(), order);
+            }
+        }
 
+        /**
+         *  Call query(i) for every query, in Morton order of the query
+         *  locations so that consecutive searches walk the same part of the
+         *  tree. Chunks of that order are handed to the runner.
+         */
+        template <typename Q, typename F>
+        void for_each_query(const std::vector<Q>& queries, const runner& run, F query) {
+            size_t count = queries.size();
+            if (count == 0) {
+                return;
+            }
+
+            // Quantize the locations to 16 bits over their bounding box
+            double min_x = deref(queries[0]).x;
+            double min_y = deref(queries[0]).y;
+            double max_x = min_x;
+            double max_y = min_y;
+            for (auto& q : queries) {
+                min_x = std::min<double>(min_x, deref(q).x);
+                min_y = std::min<double>(min_y, deref(q).y);
+                max_x = std::max<double>(max_x, deref(q).x);
+                max_y = std::max<double>(max_y, deref(q).y);
+            }
+            double scale_x = max_x > min_x ? 0xffff / (max_x - min_x) : 0;
+            double scale_y = max_y > min_y ? 0xffff / (max_y - min_y) : 0;
+
+            std::vector<std::pair<uint32_t, uint32_t>> order(count);
+            for (size_t i = 0; i < count; i++) {
+                uint32_t x = (uint32_t)((deref(queries[i]).x - min_x) * scale_x);
+                uint32_t y = (uint32_t)((deref(queries[i]).y - min_y) * scale_y);
+                order[i] = std::make_pair(morton_code(x, y), (uint32_t)i);
+            }
+            std::sort(order.begin(), order.end());
+
+            size_t chunks = (count + batch_chunk_size - 1) / batch_chunk_size;
+            auto run_chunk = [&](size_t chunk) {
+                size_t end = std::min(count, (chunk + 1) * batch_chunk_size);
+                for (size_t i = chunk * batch_chunk_size; i < end; i++) {
+                    query(order[i].second);
+                }
+            };
+            if (run && chunks > 1) {
+                run(chunks, run_chunk);
+            } else {
+                for (size_t chunk = 0; chunk < chunks; chunk++) {
+                    run_chunk(chunk);
+                }
+            }
+        }
+
+    public:
         ///-----------------------------------------------------------------------
         /// @name Constructor
         ///-----------------------------------------------------------------------
         /**
-         *  Initialize kdtree.
+         *  Initialize kdtree. The points are left in their order.
          *
          *  @param points  A vector of points.
+         *  @param run     Runs the halves of large subtrees, may be empty.
          *
          *  @return Initialized kdtree instance.
          */
         template <typename U>
-        kdtree(std::vector<U>* points) {
-          this->root = new node<T>(&(*points)[0], (int)(*points).size());
+        kdtree(const std::vector<U>* points, const runner& run = runner()) {
+            this->init(points->data(), (int)points->size(), run);
         }
 
         /**
-         *  Initialize kdtree.
+         *  Initialize kdtree. The points are left in their order.
          *
          *  @param points  An array of points.
          *  @param size    A size of the array.
+         *  @param run     Runs the halves of large subtrees, may be empty.
          *
          *  @return Initialized kdtree instance.
          */
-        kdtree(T *points, int size) {
-            this->root = new node<T>(points, size);
+        template <typename U>
+        kdtree(const U *points, int size, const runner& run = runner()) {
+            this->init(points, size, run);
         }
 
         ///-----------------------------------------------------------------------
-        /// @name Destructor
+        /// @name Structure
         ///-----------------------------------------------------------------------
         /**
-         *  Delete kdtree object.
+         *  The root node, or NULL if the tree is empty.
+         */
+        node<T> * root() {
+            return nodes_.empty() ? NULL : &nodes_[0];
+        }
+
+        /**
+         *  The node at an index stored in node::left or node::right, or NULL
+         *  for -1.
          */
-        ~kdtree() {
-            delete this->root;
+        node<T> * at(int32_t index) {
+            return index < 0 ? NULL : &nodes_[index];
+        }
+
+        size_t size() const {
+            return nodes_.size();
         }
 
         ///-----------------------------------------------------------------------
         /// @name Nearest Neighbor Search
         ///-----------------------------------------------------------------------
+        /**
+         *  Search for the nearest neighbor of a location. Does not allocate.
+         *
+         *  @param qx  An x coordinate.
+         *  @param qy  A y coordinate.
+         *
+         *  @return The nearest neighbor node, or NULL if the tree is empty.
+         */
+        node<T> * nearest(double qx, double qy) {
+            if (nodes_.empty()) {
+                return NULL;
+            }
+            return this->_nearest(qx, qy, 0, 0);
+        }
+
         /**
          *  Search for the nearest neighbor in the tree.
          *
@@ -66,7 +372,7 @@ namespace kdtree {
          *  @return The nearest neighbor node.
          */
         node<T> * nearest(T query_point) {
-            return this->root->nearest(query_point);
+            return this->nearest(deref(query_point).x, deref(query_point).y);
         }
 
         /**
@@ -77,7 +383,33 @@ namespace kdtree {
          *  @return The nearest neighbor node.
          */
         node<T> * nearest(node<T> *query) {
-            return this->root->nearest(query);
+            return this->nearest(query->x, query->y);
+        }
+
+        /**
+         *  Search for all nearest neighbors within a certain radius of a
+         *  location and append them to a caller owned buffer. Does not
+         *  allocate once the buffer has grown to fit.
+         *
+         *  Distances are compared squared. When sorted, the appended nodes
+         *  are ordered closest first, and nodes at the same distance by their
+         *  place in the tree; otherwise they are left in search order, which
+         *  makes the search linear in the number of nodes visited.
+         *
+         *  @param qx         An x coordinate.
+         *  @param qy         A y coordinate.
+         *  @param r          A radius of the circle.
+         *  @param neighbors  The buffer to append to.
+         *  @param sorted     Whether to sort the appended nodes.
+         */
+        void radius_nearest(double qx, double qy, const double r, std::vector<node<T> *>& neighbors, bool sorted = true) {
+            size_t first = neighbors.size();
+            if (!nodes_.empty()) {
+                this->_radius_nearest(neighbors, qx, qy, r, r * r, 0, 0);
+            }
+            if (sorted) {
+                std::sort(neighbors.begin() + first, neighbors.end(), closer_to{ qx, qy });
+            }
         }
 
         /**
@@ -86,10 +418,12 @@ namespace kdtree {
          *  @param query_point  A query point.
          *  @param r            A radius of the circle.
          *
-         *  @return The vector of neighbors.
+         *  @return The vector of neighbors, closest first.
          */
         std::vector<node<T> *> radius_nearest(T query_point, const double r) {
-            return this->root->radius_nearest(query_point, r);
+            std::vector<node<T> *> neighbors;
+            this->radius_nearest(deref(query_point).x, deref(query_point).y, r, neighbors);
+            return neighbors;
         }
 
         /**
@@ -98,25 +432,50 @@ namespace kdtree {
          *  @param query  A query point.
          *  @param r      A radius of the circle.
          *
-         *  @return The vector of neighbors.
+         *  @return The vector of neighbors, closest first.
          */
         std::vector<node<T> *> radius_nearest(node<T> *query, const double r) {
-            return this->root->radius_nearest(query, r);
+            std::vector<node<T> *> neighbors;
+            this->radius_nearest(query->x, query->y, r, neighbors);
+            return neighbors;
         }
 
         ///-----------------------------------------------------------------------
         /// @name k-Nearest Neighbor Search
         ///-----------------------------------------------------------------------
+        /**
+         *  Search for k-nearest neighbors of a location and append them to a
+         *  caller owned buffer, closest first. Candidates are kept in a
+         *  bounded max-heap inside the buffer, so this does not allocate once
+         *  the buffer has grown to fit. Nodes at the same distance are
+         *  ordered by their place in the tree.
+         *
+         *  @param qx         An x coordinate.
+         *  @param qy         A y coordinate.
+         *  @param k          Number of closest points to find.
+         *  @param neighbors  The buffer to append to.
+         */
+        void k_nearest(double qx, double qy, const int k, std::vector<node<T> *>& neighbors) {
+            size_t first = neighbors.size();
+            if (!nodes_.empty() && k > 0) {
+                closer_to order{ qx, qy };
+                this->_k_nearest(neighbors, first, order, k, 0, 0);
+                std::sort_heap(neighbors.begin() + first, neighbors.end(), order);
+            }
+        }
+
         /**
          *  Search for k-nearest neighbors in the tree.
          *
          *  @param query_point  A query point.
          *  @param k            Number of closest points to find.
          *
-         *  @return The vector of neighbors.
+         *  @return The vector of neighbors, closest first.
          */
         std::vector<node<T> *> k_nearest(T query_point, const int k) {
-            return this->root->k_nearest(query_point, k);
+            std::vector<node<T> *> neighbors;
+            this->k_nearest(deref(query_point).x, deref(query_point).y, k, neighbors);
+            return neighbors;
         }
 
         /**
@@ -125,10 +484,70 @@ namespace kdtree {
          *  @param query  A query node.
          *  @param k      Number of closest points to find.
          *
-         *  @return The vector of neighbors.
+         *  @return The vector of neighbors, closest first.
          */
         std::vector<node<T> *> k_nearest(node<T> *query, const int k) {
-            return this->root->k_nearest(query, k);
+            std::vector<node<T> *> neighbors;
+            this->k_nearest(query->x, query->y, k, neighbors);
+            return neighbors;
+        }
+
+        ///-----------------------------------------------------------------------
+        /// @name Batch Search
+        ///-----------------------------------------------------------------------
+        /**
+         *  Search for the nearest neighbor of every query. Queries are
+         *  searched in Morton order, possibly on several threads, and the
+         *  results are stored in the order of the queries.
+         *
+         *  @param queries  Points or pointers to points to search from.
+         *  @param nearest  Resized to hold the nearest node of each query.
+         *  @param run      Runs chunks of the queries, may be empty.
+         */
+        template <typename Q>
+        void nearest(const std::vector<Q>& queries, std::vector<node<T> *>& nearest, const runner& run = runner()) {
+            nearest.resize(queries.size());
+            this->for_each_query(queries, run, [&](size_t i) {
+                nearest[i] = this->nearest(deref(queries[i]).x, deref(queries[i]).y);
+            });
+        }
+
+        /**
+         *  Search for all nearest neighbors within a certain radius of every
+         *  query, like nearest() above. The buffer of every query is reused,
+         *  so this does not allocate once the buffers have grown to fit.
+         *
+         *  @param queries    Points or pointers to points to search from.
+         *  @param r          A radius of the circle.
+         *  @param neighbors  Resized to hold the neighbors of each query.
+         *  @param run        Runs chunks of the queries, may be empty.
+         *  @param sorted     Whether to sort the neighbors of each query.
+         */
+        template <typename Q>
+        void radius_nearest(const std::vector<Q>& queries, const double r, std::vector<std::vector<node<T> *>>& neighbors, const runner& run = runner(), bool sorted = true) {
+            neighbors.resize(queries.size());
+            this->for_each_query(queries, run, [&](size_t i) {
+                neighbors[i].clear();
+                this->radius_nearest(deref(queries[i]).x, deref(queries[i]).y, r, neighbors[i], sorted);
+            });
+        }
+
+        /**
+         *  Search for k-nearest neighbors of every query, like nearest()
+         *  above. The buffer of every query is reused.
+         *
+         *  @param queries    Points or pointers to points to search from.
+         *  @param k          Number of closest points to find.
+         *  @param neighbors  Resized to hold the neighbors of each query.
+         *  @param run        Runs chunks of the queries, may be empty.
+         */
+        template <typename Q>
+        void k_nearest(const std::vector<Q>& queries, const int k, std::vector<std::vector<node<T> *>>& neighbors, const runner& run = runner()) {
+            neighbors.resize(queries.size());
+            this->for_each_query(queries, run, [&](size_t i) {
+                neighbors[i].clear();
+                this->k_nearest(deref(queries[i]).x, deref(queries[i]).y, k, neighbors[i]);
+            });
         }
     };
 }
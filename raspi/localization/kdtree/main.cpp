@@ -12,6 +12,8 @@
 #include <set>
 #include <ctime> // for time()
 #include <cstdlib> // for srand(), rand()
+#include <functional>
+#include <thread>
 
 #include "benchmark.hpp"
 #include "kdtree.hpp"
@@ -23,6 +25,27 @@ using namespace kdtree;
 
 #pragma mark - Helper
 
+// Runs the bodies on a few threads, which take them in turn
+::kdtree::runner thread_runner(int num_threads)
+{
+    return [num_threads](size_t count, const function<void(size_t)>& body) {
+        vector<thread> threads;
+        for (int t = 1; t < num_threads; t++) {
+            threads.push_back(thread([&, t]() {
+                for (size_t i = t; i < count; i += num_threads) {
+                    body(i);
+                }
+            }));
+        }
+        for (size_t i = 0; i < count; i += num_threads) {
+            body(i);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    };
+}
+
 inline int random(int min, int max) // Example: random(0, 3) => 0, 1, 2
 {
     return min + rand() % (max - min);
@@ -196,7 +219,7 @@ void test_kdtree()
         pointi(50, 50)  // 5
     };
     
-    kdtree<pointi> *tree = new kdtree<pointi>(points);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
     
     /*
      Estimated tree:
@@ -208,7 +231,7 @@ void test_kdtree()
      */
     
     // The root node of the tree should have left node and right node
-    node<pointi> *root = tree->root;
+    node<pointi> *root = tree->root();
     assert(root->has_left_node());
     assert(root->has_right_node());
 
@@ -216,7 +239,7 @@ void test_kdtree()
     assert(root->point == pointi(30, 30));
     
     // The left node of the root should have left node only
-    node<pointi> *left_node = root->left;
+    node<pointi> *left_node = tree->at(root->left);
     assert(left_node->has_left_node());
     assert(!left_node->has_right_node());
     
@@ -224,7 +247,7 @@ void test_kdtree()
     assert(left_node->point == pointi(20, 20));
     
     // The right node of the root should have left node only
-    node<pointi> *right_node = root->right;
+    node<pointi> *right_node = tree->at(root->right);
     assert(right_node->has_left_node());
     assert(!right_node->has_right_node());
     
@@ -232,20 +255,20 @@ void test_kdtree()
     assert(right_node->point == pointi(50, 50));
     
     // The left leaf of the tree should have no child node
-    node<pointi> *left_leaf = left_node->left;
+    node<pointi> *left_leaf = tree->at(left_node->left);
     assert(left_leaf->is_leaf());
     
     // ... and have the point (10, 10)
     assert(left_leaf->point == pointi(10, 10));
     
     // The right leaf of the tree should have no child node
-    node<pointi> *right_leaf = right_node->left;
+    node<pointi> *right_leaf = tree->at(right_node->left);
     assert(right_leaf->is_leaf());
     
     // ... and have the point (40, 40)
     assert(right_leaf->point == pointi(40, 40));
     
-    delete root;
+    delete tree;
 }
 
 void test_nearest()
@@ -258,7 +281,7 @@ void test_nearest()
         pointi(160, 160)
     };
     
-    kdtree<pointi> *tree = new kdtree<pointi>(points);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
     
     /*
      Estimated tree:
@@ -287,7 +310,7 @@ void test_radius_nearest()
         pointi(160, 0) // 5
     };
     
-    kdtree<pointi> *tree = new kdtree<pointi>(points);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
     
     /*
      Estimated tree:
@@ -323,7 +346,7 @@ void test_k_nearest()
         pointi(160, 0) // 5
     };
     
-    kdtree<pointi> *tree = new kdtree<pointi>(points);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
     
     /*
      Estimated tree:
@@ -352,7 +375,7 @@ void test_k_nearest()
 void test_nearest_random()
 {
     vector<pointi> points = random_points(1000, 1, 100);
-    kdtree<pointi> *tree = new kdtree<pointi>(points);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
     
     pointi query_point = random_point(1, 100);
     
@@ -377,7 +400,7 @@ void test_nearest_random()
 void test_radius_nearest_random()
 {
     vector<pointi> points = random_points(1000, 1, 100);
-    kdtree<pointi> *tree = new kdtree<pointi>(points);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
     
     pointi query_point = random_point(1, 100);
     double r = 30.0;
@@ -408,7 +431,7 @@ void test_radius_nearest_random()
 void test_k_nearest_random()
 {
     vector<pointi> points = random_points(1000, 1, 100);
-    kdtree<pointi> *tree = new kdtree<pointi>(points);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
     
     pointi query_point = random_point(1, 100);
     int k = random(5, 20);
@@ -436,6 +459,188 @@ void test_k_nearest_random()
     delete tree;
 }
 
+void test_radius_nearest_unsorted_random()
+{
+    vector<pointi> points = random_points(1000, 1, 100);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
+    
+    pointi query_point = random_point(1, 100);
+    double r = 30.0;
+    
+    vector<pointi> sf_neighbors = sf_radius_nearest(points, query_point, r);
+    
+    // Search into a buffer that already holds a node, without sorting
+    vector<node<pointi> *> neighbors(1, tree->root());
+    benchmark("kdtree unsorted") {
+        tree->radius_nearest(query_point.x, query_point.y, r, neighbors, false);
+    }
+    
+    // The existing entry should be kept and the size should be equal
+    assert(neighbors[0] == tree->root());
+    assert(neighbors.size() == sf_neighbors.size() + 1);
+    
+    // The distances should be equal once sorted
+    vector<double> distances;
+    for (int i = 1; i < neighbors.size(); i++) {
+        assert(neighbors.at(i)->point.distance(query_point) <= r);
+        distances.push_back(neighbors.at(i)->point.distance(query_point));
+    }
+    sort(distances.begin(), distances.end());
+    for (int i = 0; i < distances.size(); i++) {
+        assert(distances.at(i) == sf_neighbors.at(i).distance(query_point));
+    }
+    
+    delete tree;
+}
+
+void test_k_nearest_ties()
+{
+    // A grid has many points at the same distance from a grid point
+    vector<pointi> points;
+    for (int x = 0; x < 30; x++) {
+        for (int y = 0; y < 30; y++) {
+            points.push_back(pointi(x, y));
+        }
+    }
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
+    
+    for (int k = 1; k <= 40; k++) {
+        pointi query_point = random_point(0, 30);
+        vector<pointi> sf_neighbors = sf_k_nearest(points, query_point, k);
+        
+        vector<node<pointi> *> neighbors;
+        tree->k_nearest(query_point.x, query_point.y, k, neighbors);
+        
+        // The distances of results should be equal, and the same nodes
+        // should come back however the search reached them
+        assert(neighbors.size() == sf_neighbors.size());
+        for (int i = 0; i < neighbors.size(); i++) {
+            assert(neighbors.at(i)->point.distance(query_point) == sf_neighbors.at(i).distance(query_point));
+        }
+        vector<node<pointi> *> sorted_neighbors;
+        tree->radius_nearest(query_point.x, query_point.y, 100, sorted_neighbors);
+        sorted_neighbors.resize(k);
+        assert(neighbors == sorted_neighbors);
+    }
+    
+    // Asking for more than the tree holds returns every node
+    vector<node<pointi> *> neighbors;
+    tree->k_nearest(5, 5, 1000, neighbors);
+    assert(neighbors.size() == points.size());
+    
+    delete tree;
+}
+
+void test_build_parallel_random()
+{
+    vector<pointi> points = random_points(100000, 1, 10000);
+    vector<pointi> original = points;
+    
+    ::kdtree::runner run = thread_runner(2);
+    
+    ::kdtree::kdtree<pointi> *serial_tree;
+    ::kdtree::kdtree<pointi> *parallel_tree;
+    benchmark("kdtree build") {
+        serial_tree = new ::kdtree::kdtree<pointi>(&points);
+    }
+    benchmark("kdtree parallel build") {
+        parallel_tree = new ::kdtree::kdtree<pointi>(&points, run);
+    }
+    
+    // The points should be left in their order
+    for (int i = 0; i < points.size(); i++) {
+        assert(points.at(i) == original.at(i));
+    }
+    
+    // Both builds should give the same tree
+    assert(serial_tree->size() == points.size());
+    assert(parallel_tree->size() == points.size());
+    for (int i = 0; i < points.size(); i++) {
+        node<pointi> *a = serial_tree->at(i);
+        node<pointi> *b = parallel_tree->at(i);
+        assert(a->point == b->point);
+        assert(a->left == b->left && a->right == b->right);
+    }
+    
+    // Every node should split its subtrees
+    for (int i = 0; i < points.size(); i++) {
+        node<pointi> *self = serial_tree->at(i);
+        int depth = 0;
+        for (int j = 0; j != i; depth++) {
+            node<pointi> *parent = serial_tree->at(j);
+            j = (parent->right >= 0 && i >= parent->right) ? parent->right : parent->left;
+        }
+        bool is_even = !(depth & 1);
+        node<pointi> *left = serial_tree->at(self->left);
+        node<pointi> *right = serial_tree->at(self->right);
+        if (left) {
+            assert(is_even ? left->x <= self->x : left->y <= self->y);
+        }
+        if (right) {
+            assert(is_even ? right->x >= self->x : right->y >= self->y);
+        }
+    }
+    
+    // Searches should still agree with the brute force
+    pointi query_point = random_point(1, 10000);
+    assert(parallel_tree->nearest(query_point)->distance(query_point) == sf_nearest(points, query_point).distance(query_point));
+    
+    delete serial_tree;
+    delete parallel_tree;
+}
+
+void test_batch_random()
+{
+    vector<pointi> points = random_points(10000, 1, 1000);
+    ::kdtree::kdtree<pointi> *tree = new ::kdtree::kdtree<pointi>(&points);
+    ::kdtree::runner run = thread_runner(3);
+    
+    vector<pointi> queries;
+    for (int i = 0; i < 5000; i++) {
+        queries.push_back(random_point(-10, 1010));
+    }
+    
+    // The batch searches should give what one search at a time gives, in the order of the queries
+    vector<node<pointi> *> nearest;
+    benchmark("kdtree nearest one by one") {
+        for (int i = 0; i < queries.size(); i++) {
+            tree->nearest(queries.at(i));
+        }
+    }
+    benchmark("kdtree nearest batch") {
+        tree->nearest(queries, nearest, run);
+    }
+    assert(nearest.size() == queries.size());
+    for (int i = 0; i < queries.size(); i++) {
+        assert(nearest.at(i) == tree->nearest(queries.at(i)));
+    }
+    
+    vector<vector<node<pointi> *>> neighbors;
+    for (bool sorted : { true, false }) {
+        tree->radius_nearest(queries, 30.0, neighbors, run, sorted);
+        assert(neighbors.size() == queries.size());
+        for (int i = 0; i < queries.size(); i++) {
+            vector<node<pointi> *> expected;
+            tree->radius_nearest(queries.at(i).x, queries.at(i).y, 30.0, expected, sorted);
+            assert(neighbors.at(i) == expected);
+        }
+    }
+    
+    // Buffers left from the radius search are reused
+    tree->k_nearest(queries, 7, neighbors);
+    assert(neighbors.size() == queries.size());
+    for (int i = 0; i < queries.size(); i++) {
+        assert(neighbors.at(i) == tree->k_nearest(queries.at(i), 7));
+    }
+    
+    // An empty batch gives no results
+    vector<pointi> no_queries;
+    tree->nearest(no_queries, nearest, run);
+    assert(nearest.empty());
+    
+    delete tree;
+}
+
 
 #pragma mark - Main
 
@@ -455,6 +660,10 @@ int main(int argc, const char * argv[])
     test_nearest_random();
     test_radius_nearest_random();
     test_k_nearest_random();
+    test_radius_nearest_unsorted_random();
+    test_k_nearest_ties();
+    test_build_parallel_random();
+    test_batch_random();
     
     return 0;
 }
@@ -0,0 +1,141 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "indexed_heap.h"
+#include "landmarks.h"
+
+namespace wins {
+
+#define LANDMARKS_BYTE_ORDER 0x01020304
+
+namespace {
+  const double kUnreached = numeric_limits<double>::infinity();
+
+  // Dijkstra from source over the whole graph into distances.
+  void ShortestDistances(const WalkGraph& graph, int32_t source,
+      IndexedHeap<double>& open, vector<double>& distances) {
+    distances.assign(graph.num_nodes(), kUnreached);
+    open.Clear();
+    distances[source] = 0;
+    open.Push(source, 0);
+    while (not open.empty()) {
+      int32_t current = open.Pop();
+      for (int32_t e = graph.edges_begin(current);
+          e < graph.edges_end(current); ++e) {
+        int32_t next = graph.target(e);
+        double new_distance = distances[current] + graph.length(e);
+        if (new_distance < distances[next]) {
+          distances[next] = new_distance;
+          open.Push(next, new_distance);
+        }
+      }
+    }
+  }
+} // anonymous namespace
+
+void Landmarks::Build(const WalkGraph& graph, size_t count) {
+  size_t num_nodes = graph.num_nodes();
+  count = min(count, num_nodes);
+  num_nodes_ = num_nodes;
+  num_edges_ = graph.num_edges();
+  tree_hash_ = graph.tree_hash();
+  radius_ = graph.radius();
+  nodes_.clear();
+  distances_.assign(num_nodes * count, kUnreached);
+  if (count == 0) {
+    return;
+  }
+
+  IndexedHeap<double> open;
+  open.Resize(num_nodes);
+  vector<double> distances;
+  // Distance from each node to the nearest landmark so far. The first
+  // landmark is the node farthest from node 0.
+  vector<double> nearest;
+  ShortestDistances(graph, 0, open, nearest);
+  for (size_t l = 0; l < count; ++l) {
+    int32_t landmark = max_element(nearest.begin(), nearest.end()) -
+        nearest.begin();
+    nodes_.push_back(landmark);
+    ShortestDistances(graph, landmark, open, distances);
+    for (size_t i = 0; i < num_nodes; ++i) {
+      distances_[i * count + l] = distances[i];
+      nearest[i] = min(nearest[i], distances[i]);
+    }
+  }
+}
+
+bool Landmarks::Load(const string& filename, const WalkGraph& graph) {
+  ifstream is(filename, ios::binary);
+  LandmarksHeader header;
+  is.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (not is or
+      memcmp(header.magic, LANDMARKS_MAGIC, sizeof(LANDMARKS_MAGIC)) != 0 or
+      header.version != LANDMARKS_VERSION or
+      header.byte_order != LANDMARKS_BYTE_ORDER or
+      header.num_nodes != graph.num_nodes() or
+      header.num_edges != graph.num_edges() or
+      header.tree_hash != graph.tree_hash() or
+      header.radius != graph.radius() or header.count > header.num_nodes) {
+    return false;
+  }
+  is.seekg(0, ios::end);
+  uint64_t expected = sizeof(header) + header.count * sizeof(int32_t) +
+      header.num_nodes * header.count * sizeof(double);
+  if ((uint64_t)is.tellg() != expected) {
+    return false;
+  }
+  is.seekg(sizeof(header));
+  vector<int32_t> nodes(header.count);
+  vector<double> distances(header.num_nodes * header.count);
+  is.read(reinterpret_cast<char*>(nodes.data()),
+      nodes.size() * sizeof(int32_t));
+  is.read(reinterpret_cast<char*>(distances.data()),
+      distances.size() * sizeof(double));
+  if (not is) {
+    return false;
+  }
+  for (auto node : nodes) {
+    if (node < 0 or (uint64_t)node >= header.num_nodes) {
+      return false;
+    }
+  }
+  num_nodes_ = header.num_nodes;
+  num_edges_ = header.num_edges;
+  tree_hash_ = header.tree_hash;
+  radius_ = header.radius;
+  nodes_ = move(nodes);
+  distances_ = move(distances);
+  return true;
+}
+
+void Landmarks::Write(const string& filename) const {
+  LandmarksHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LANDMARKS_MAGIC, sizeof(LANDMARKS_MAGIC));
+  header.version = LANDMARKS_VERSION;
+  header.byte_order = LANDMARKS_BYTE_ORDER;
+  header.num_nodes = num_nodes_;
+  header.num_edges = num_edges_;
+  header.tree_hash = tree_hash_;
+  header.radius = radius_;
+  header.count = nodes_.size();
+
+  ofstream os(filename, ios::binary);
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char*>(nodes_.data()),
+      nodes_.size() * sizeof(int32_t));
+  os.write(reinterpret_cast<const char*>(distances_.data()),
+      distances_.size() * sizeof(double));
+  if (not os) {
+    throw runtime_error("Could not write " + filename);
+  }
+}
+
+void Landmarks::Clear() {
+  nodes_.clear();
+  distances_.clear();
+}
+
+}
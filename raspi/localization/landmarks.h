@@ -0,0 +1,95 @@
+#ifndef LANDMARKS_H
+#define LANDMARKS_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "common_utils.h"
+#include "walk_graph.h"
+
+namespace wins {
+
+#define LANDMARKS_MAGIC "WINSALT"
+#define LANDMARKS_VERSION 1
+#define LANDMARKS_SUFFIX ".alt"
+// Landmarks picked for a map by WriteMap.
+#define LANDMARK_COUNT 16
+
+// Exact walking distances from a few landmark nodes to every node of a
+// WalkGraph, for the ALT lower bound on the distance between two nodes:
+// by the triangle inequality d(a, b) >= |d(l, a) - d(l, b)| for any
+// landmark l. Unlike the straight-line distance, this bound knows about
+// walls, so A* stops wandering into dead ends that point at the goal.
+//
+// Landmarks are picked far apart: each one is the node farthest by walking
+// distance from those picked before it. Nodes a landmark cannot reach are
+// at infinite distance from it, so islands of the graph each get one.
+//
+// The distances can be cached in a side-car of the map file. Layout:
+//
+//   header     LandmarksHeader
+//   nodes      int32_t[count]
+//   distances  double[num_nodes * count], all landmarks of node 0 first
+//
+// A side-car only matches the graph it was computed over, which the header
+// identifies by its tree hash, radius and size.
+struct LandmarksHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t num_nodes;
+  uint64_t num_edges;
+  uint64_t tree_hash;
+  double radius;
+  uint64_t count;
+};
+
+class Landmarks {
+ private:
+  uint64_t num_nodes_ = 0;
+  uint64_t num_edges_ = 0;
+  uint64_t tree_hash_ = 0;
+  double radius_ = 0;
+  vector<int32_t> nodes_;
+  vector<double> distances_;
+
+ public:
+  // The side-car name used for a map file.
+  static string FileFor(const string& map_filename) {
+    return map_filename + LANDMARKS_SUFFIX;
+  }
+
+  // Picks up to count landmarks. Runs a shortest path search over the whole
+  // graph per landmark, so it is meant for offline use.
+  void Build(const WalkGraph& graph, size_t count);
+  // Returns false, leaving the landmarks as they were, if the file is
+  // missing or does not match graph.
+  bool Load(const string& filename, const WalkGraph& graph);
+  void Write(const string& filename) const;
+  // Drops all landmarks, LowerBound is then always 0.
+  void Clear();
+
+  size_t size() const { return nodes_.size(); }
+  int32_t node(size_t landmark) const { return nodes_[landmark]; }
+
+  // Lower bound on the walking distance between nodes from and to.
+  double LowerBound(int32_t from, int32_t to) const {
+    size_t count = nodes_.size();
+    const double* a = distances_.data() + from * count;
+    const double* b = distances_.data() + to * count;
+    double bound = 0;
+    for (size_t l = 0; l < count; ++l) {
+      // An infinite distance only says the landmark is on another island.
+      double diff = fabs(a[l] - b[l]);
+      if (diff > bound and diff < numeric_limits<double>::infinity()) {
+        bound = diff;
+      }
+    }
+    return bound;
+  }
+};
+
+}
+
+#endif // LANDMARKS_H
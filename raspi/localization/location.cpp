@@ -1,5 +1,4 @@
 #include <functional>
-#include <future>
 #include <stdexcept>
 #include <type_traits>
 
@@ -16,8 +15,6 @@ namespace wins {
 using namespace std;
 
 #define HIGH_VARIANCE 10000
-#define NORMAL_MAX_DIST 20
-#define MAX_MAX_DIST 500
 #define MAX_UNKNOWN_COUNT 20
 
 namespace {
@@ -26,13 +23,15 @@ bool close_enough(double a, double b) {
 }
 }
 
-Eigen::MatrixXd Location::prev_X;
-Eigen::MatrixXd Location::prev_P;
-Eigen::MatrixXd Location::A;
-Eigen::MatrixXd Location::A_t;
-Eigen::MatrixXd Location::const_R;
+Eigen::Matrix<double, SVARS, 1> Location::prev_X;
+Eigen::Matrix<double, SVARS, SVARS> Location::prev_P;
+Eigen::Matrix2d Location::A;
+Eigen::Matrix2d Location::A_t;
+Eigen::Matrix2d Location::const_R;
 
 vector<unique_ptr<WiFiEstimate>> Location::wifi_estimators_;
+vector<unique_ptr<WorkerPool>> Location::adapter_workers_;
+unique_ptr<WorkerPool> Location::compute_pool_;
 PointEstimate Location::point_estimate_;
 atomic<kdtree::node<Point*>*> Location::current_node_(nullptr);
 LocationVariant Location::variant_ = (LocationVariant)
@@ -57,20 +56,58 @@ double Location::prev_y = -1;
 vector<PointEstimate> Location::GetWiFiReadings(int count) {
   vector<PointEstimate> estimates;
   vector<future<vector<PointEstimate>>> handles;
-  for (auto& estimator : wifi_estimators_) {
-    auto handle = async(launch::async, &WiFiEstimate::EstimateLocation,
-          estimator.get(), Global::ScanVariant, count);
-    handles.push_back(move(handle));
+  for (size_t i = 0; i < wifi_estimators_.size(); ++i) {
+    auto estimator = wifi_estimators_[i].get();
+    auto variant = Global::ScanVariant;
+    handles.push_back(adapter_workers_[i]->Submit([=]() {
+      return estimator->EstimateLocation(variant, count);
+    }));
   }
-  for (auto& result : handles) {
-    auto vec = result.get();
+  for (size_t i = 0; i < handles.size(); ++i) {
+    auto vec = handles[i].get();
     if (vec.size() > 0) {
       estimates.push_back(vec[0]);
     }
+    auto stats = adapter_workers_[i]->Stats();
+    FILE_LOG(logDEBUG) << adapter_workers_[i]->name() << " took "
+        << stats.last_latency_ms << "ms, mean " << stats.mean_latency_ms
+        << "ms, max " << stats.max_latency_ms << "ms\n";
   }
   return estimates;
 }
 
+vector<WorkerPoolStats> Location::GetWorkerStats() {
+  vector<WorkerPoolStats> stats;
+  for (auto& worker : adapter_workers_) {
+    stats.push_back(worker->Stats());
+  }
+  if (compute_pool_) {
+    stats.push_back(compute_pool_->Stats());
+  }
+  return stats;
+}
+
+void Location::StartWorkers() {
+  adapter_workers_.clear();
+  for (size_t i = 0; i < wifi_estimators_.size(); ++i) {
+    string name = i < Global::WiFiDevices.size() ?
+        Global::WiFiDevices[i] : "wifi" + to_string(i);
+    adapter_workers_.push_back(unique_ptr<WorkerPool>(
+        new WorkerPool(name, 1, i)));
+  }
+  for (auto& estimator : wifi_estimators_) {
+    estimator->SetComputePool(ComputePool());
+  }
+}
+
+WorkerPool* Location::ComputePool() {
+  if (not compute_pool_) {
+    compute_pool_.reset(new WorkerPool("compute",
+        max(1u, thread::hardware_concurrency())));
+  }
+  return compute_pool_.get();
+}
+
 void Location::InitialEstimate() {
   auto estimates = GetWiFiReadings(Global::InitWiFiReadings);
   if (estimates.size() > 0) {
@@ -83,12 +120,12 @@ void Location::InitialEstimate() {
 }
 
 void Location::InitKalman() {
-  A = Eigen::MatrixXd::Identity(2,2);
+  A.setIdentity();
   A_t = A.transpose();
-  //const_R = 2 * Eigen::MatrixXd::Identity(2,2);
-  const_R = Eigen::MatrixXd::Identity(2,2) * Global::LocationRFactor;
-  prev_X = Eigen::MatrixXd::Identity(SVARS,1);
-  prev_P = Eigen::MatrixXd::Zero(SVARS, SVARS);
+  //const_R = 2 * Eigen::Matrix2d::Identity();
+  const_R = Eigen::Matrix2d::Identity() * Global::LocationRFactor;
+  prev_X = Eigen::Matrix<double, SVARS, 1>::Identity();
+  prev_P.setZero();
 }
 
 void Location::Init() {
@@ -102,11 +139,12 @@ void Location::Init() {
         new WiFiEstimate(unique_ptr<WifiScan>(
         new WifiScan(default_channels, device)))));
   }
+  StartWorkers();
   Map::UpdateLikelyPoints(numeric_limits<double>::max());
   InitialEstimate();
 }
 
-bool Location::DoKalmanUpdate(vector<PointEstimate> wifi_estimates) {
+bool Location::DoKalmanUpdate(const vector<PointEstimate>& wifi_estimates) {
   int msecs;
 
   if (wifi_estimates.size() == 0) {
@@ -138,18 +176,13 @@ bool Location::DoKalmanUpdate(vector<PointEstimate> wifi_estimates) {
     msecs = 0;
   }
 
-  Eigen::MatrixXd X(2,1);
-  Eigen::MatrixXd P(2,2);
-  Eigen::MatrixXd Z(wifi_estimates.size() * 2, 1);
-  Eigen::MatrixXd H(wifi_estimates.size() * 2, 2);
-  Eigen::MatrixXd H_t(2, wifi_estimates.size() * 2);
-  Eigen::MatrixXd R(wifi_estimates.size() * 2, wifi_estimates.size() * 2);
-  Eigen::MatrixXd Q(2,2);
+  Eigen::Vector2d X;
+  Eigen::Matrix2d P;
 
   bool hasnan = false;
   for (int i = 0; i < 2; ++i) {
     //cout << "i = " << i << ",";
-    if (std::isnan((double)X(i,0))) {
+    if (std::isnan((double)Imu::X(i,0))) {
       hasnan = true;
       break;
     }
@@ -162,27 +195,13 @@ bool Location::DoKalmanUpdate(vector<PointEstimate> wifi_estimates) {
     P = Imu::P.block<2,2>(0,0);
   }
 
-  Q = Global::Scale * Eigen::MatrixXd::Identity(2,2) * (msecs / 1000) *
-      Global::LocationQFactor;
-  R.setZero();
-
-  for (size_t i = 0; i < wifi_estimates.size(); ++i) {
-    Z(i*2, 0) = wifi_estimates[i].x_mean;
-    Z(i*2+1, 0) = wifi_estimates[i].y_mean;
-    H.block<2,2>(i*2, 0) << 1, 0,
-                            0, 1;
-    if (variant_ & LOCATION_VARIANT_FIXED_R) {
-      R.block<2,2>(i*2, i*2) = const_R;
-    } else {
-      R(i*2, i*2) = wifi_estimates[i].x_var;
-      R(i*2+1, i*2+1) = wifi_estimates[i].y_var;
-    }
-  }
-  if (std::isnan((double)Z(0,0)), std::isnan((double)Z(1,0))) {
-    Z(0,0) = X(0,0);
-    Z(1,0) = X(1,0);
-  }
-  H_t = H.transpose();
+  Eigen::Matrix2d Q = Global::Scale * Eigen::Matrix2d::Identity() *
+      (msecs / 1000) * Global::LocationQFactor;
+  // Every estimate measures the position itself with its own noise, so
+  // correcting by one estimate after the other comes to the same as
+  // correcting by all of them stacked into one measurement.
+  Eigen::Matrix2d H = Eigen::Matrix2d::Identity();
+  Eigen::Matrix2d H_t = H.transpose();
 
   //cout << "I x = " << X(0,0) <<", y = " << X(1,0) << "\n";
   imu_x = X(0,0);
@@ -191,10 +210,24 @@ bool Location::DoKalmanUpdate(vector<PointEstimate> wifi_estimates) {
   wifi_y = wifi_estimates[0].y_mean;
 
   Eigen::IOFormat CleanFmt(4, 0, ", ", "\n", "[", "]");
-  //cout << "R :\n" << R.format(CleanFmt) << "\n";
   //cout << "Q :\n" << Q.format(CleanFmt) << "\n";
   //cout << "P before: " << P.format(CleanFmt) << "\n\n";
-  KalmanUpdate(X, P, Z, A, A_t, H, H_t, R, Q);
+  KalmanPredict<2>(X, P, A, A_t, Q);
+  for (size_t i = 0; i < wifi_estimates.size(); ++i) {
+    Eigen::Vector2d Z(wifi_estimates[i].x_mean, wifi_estimates[i].y_mean);
+    if (i == 0 and (std::isnan(Z(0,0)) or std::isnan(Z(1,0)))) {
+      Z = X;
+    }
+    Eigen::Matrix2d R;
+    if (variant_ & LOCATION_VARIANT_FIXED_R) {
+      R = const_R;
+    } else {
+      R << wifi_estimates[i].x_var, 0,
+           0, wifi_estimates[i].y_var;
+    }
+    //cout << "R :\n" << R.format(CleanFmt) << "\n";
+    KalmanCorrect<2, 2>(X, P, Z, H, H_t, R);
+  }
 
   kalman_x = X(0,0);
   kalman_y = X(1,0);
@@ -249,9 +282,9 @@ void Location::UpdateEstimate() {
   Imu::EstimateLocation(secs);
   Map::UpdateLikelyPoints(max_distance_ * Global::Scale);
   if (not DoKalmanUpdate(wifi_estimates) and max_distance_ <= MAX_MAX_DIST) {
-    max_distance_ *= 1.5;
+    max_distance_ *= MAX_DIST_STEP;
   } else if (not close_enough(max_distance_, NORMAL_MAX_DIST)) {
-    max_distance_ /= 1.5;
+    max_distance_ /= MAX_DIST_STEP;
   }
 	//FILE_LOG(logLOCATION) <<"max dist = " << max_distance_ << "\n";
 }
@@ -272,6 +305,7 @@ vector<FakeWifiScan*> Location::TestInit(vector<vector<Result>> setup_points,
     wifi_estimators_.push_back(unique_ptr<WiFiEstimate>(
         new WiFiEstimate(unique_ptr<WifiScan>(move(fakescanner)))));
   }
+  StartWorkers();
 
   Map::UpdateLikelyPoints(numeric_limits<double>::max());
   InitialEstimate();
@@ -287,4 +321,8 @@ void Location::TestSetCurrentNode(kdtree::node<Point*>* node) {
   current_node_ = node;
 }
 
+bool Location::TestKalmanUpdate(const vector<PointEstimate>& wifi_estimates) {
+  return DoKalmanUpdate(wifi_estimates);
+}
+
 }
@@ -5,13 +5,22 @@
 
 #include "common_utils.h"
 #include "fake_wifiscan.h"
+#include "imu.h"
 #include "kdtree/node.hpp"
 #include "point.h"
 #include "wifi_estimate.h"
 #include "wifiscan.h"
+#include "worker_pool.h"
 
 namespace wins {
 
+// The radius of the likely points, before Global::Scale. It grows by
+// MAX_DIST_STEP after every failed update while not above MAX_MAX_DIST, and
+// shrinks back towards NORMAL_MAX_DIST after a good one.
+#define NORMAL_MAX_DIST 20
+#define MAX_MAX_DIST 500
+#define MAX_DIST_STEP 1.5
+
 enum LocationVariant {
   LOCATION_VARIANT_NONE       = 0,
   LOCATION_VARIANT_FIXED_R    = 1,
@@ -27,19 +36,24 @@ class Location {
   static chrono::steady_clock::time_point tp_epoch_;
   static chrono::steady_clock::time_point last_update_time_;
 
-  static Eigen::MatrixXd prev_X;
-  static Eigen::MatrixXd prev_P;
-  static Eigen::MatrixXd A;
-  static Eigen::MatrixXd A_t;
-  static Eigen::MatrixXd const_R;
+  static Eigen::Matrix<double, SVARS, 1> prev_X;
+  static Eigen::Matrix<double, SVARS, SVARS> prev_P;
+  static Eigen::Matrix2d A;
+  static Eigen::Matrix2d A_t;
+  static Eigen::Matrix2d const_R;
 
   static vector<unique_ptr<WiFiEstimate>> wifi_estimators_;
+  // One pinned worker per WiFi adapter, indexed like wifi_estimators_, and
+  // a pool for splitting up the scoring work.
+  static vector<unique_ptr<WorkerPool>> adapter_workers_;
+  static unique_ptr<WorkerPool> compute_pool_;
   static atomic<kdtree::node<Point*>*> current_node_;
   static PointEstimate point_estimate_;
 
   static void InitialEstimate();
   static void InitKalman();
-  static bool DoKalmanUpdate(vector<PointEstimate> wifi_estimates);
+  static void StartWorkers();
+  static bool DoKalmanUpdate(const vector<PointEstimate>& wifi_estimates);
 
  public:
   static double imu_x;
@@ -52,6 +66,12 @@ class Location {
   static double prev_y;
 
   static vector<PointEstimate> GetWiFiReadings(int count = 1);
+  // Stats of every adapter worker, in adapter order, then of the compute
+  // pool.
+  static vector<WorkerPoolStats> GetWorkerStats();
+  // The pool shared by the scoring work and the map loader, started on
+  // first use.
+  static WorkerPool* ComputePool();
   static void Init();
   static kdtree::node<Point*>* GetCurrentNode();
   static void UpdateEstimate();
@@ -60,6 +80,8 @@ class Location {
       int num_wifis);
   static vector<Result> GetScans();
   static void TestSetCurrentNode(kdtree::node<Point*>* node);
+  // Runs the filter update of UpdateEstimate on the given WiFi estimates.
+  static bool TestKalmanUpdate(const vector<PointEstimate>& wifi_estimates);
 };
 
 }
@@ -0,0 +1,244 @@
+// Keep a * b + c as two roundings so every kernel matches the scalar one.
+#pragma GCC optimize ("fp-contract=off")
+
+#include <cmath>
+
+#include "mahalanobis_kernel.h"
+
+// SSE2 is part of the x86-64 baseline, AVX2 is checked at runtime.
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define MAHALANOBIS_X86
+#elif defined(__aarch64__)
+// ARMv7 NEON has no double precision lanes, so only AArch64 gets a vector
+// kernel on ARM. 32 bit Pi builds use the scalar kernel.
+#include <arm_neon.h>
+#define MAHALANOBIS_NEON
+#endif
+
+namespace wins {
+
+namespace {
+
+inline uint64_t PresenceWord(const FingerprintStore& fingerprints,
+    int point, int ap) {
+  return fingerprints.presence_row(point)[ap >> 6];
+}
+
+#ifdef MAHALANOBIS_X86
+void MahalanobisScoresSSE2(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs) {
+  const __m128d one = _mm_set1_pd(1.0);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    const double* mean0 = fingerprints.mean_row(points[i]);
+    const double* mean1 = fingerprints.mean_row(points[i + 1]);
+    const double* var0 = fingerprints.var_row(points[i]);
+    const double* var1 = fingerprints.var_row(points[i + 1]);
+    __m128d sum = _mm_setzero_pd();
+    __m128d df = _mm_setzero_pd();
+    for (size_t a = 0; a < scan.size(); ++a) {
+      int ap = scan.ap[a];
+      uint64_t bit = (uint64_t)1 << (ap & 63);
+      uint64_t word0 = PresenceWord(fingerprints, points[i], ap);
+      uint64_t word1 = PresenceWord(fingerprints, points[i + 1], ap);
+      __m128i seen = _mm_set_epi64x(-(int64_t)((word1 & bit) != 0),
+          -(int64_t)((word0 & bit) != 0));
+      __m128d mask = _mm_castsi128_pd(seen);
+      __m128d mean = _mm_set_pd(mean1[ap], mean0[ap]);
+      __m128d std_dev = _mm_sqrt_pd(_mm_set_pd(var1[ap], var0[ap]));
+      __m128d z = _mm_div_pd(
+          _mm_sub_pd(_mm_set1_pd(scan.signal[a]), mean), std_dev);
+      sum = _mm_add_pd(sum, _mm_and_pd(mask, _mm_mul_pd(z, z)));
+      df = _mm_add_pd(df, _mm_and_pd(mask, one));
+    }
+    double df_out[2];
+    _mm_storeu_pd(&sums[i], sum);
+    _mm_storeu_pd(df_out, df);
+    dfs[i] = (int)df_out[0];
+    dfs[i + 1] = (int)df_out[1];
+  }
+  if (i < count) {
+    MahalanobisScoresScalar(fingerprints, scan, points + i, count - i,
+        sums + i, dfs + i);
+  }
+}
+
+__attribute__((target("avx2")))
+void MahalanobisScoresAVX2(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs) {
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256i low_bit = _mm256_set1_epi64x(1);
+  const long long stride = fingerprints.ap_stride();
+  const long long words = fingerprints.mask_words();
+  size_t i = 0;
+  if (count < 4) {
+    MahalanobisScoresSSE2(fingerprints, scan, points, count, sums, dfs);
+    return;
+  }
+  // All rows are addressed relative to the first point's row.
+  const double* mean_base = fingerprints.mean_row(0);
+  const double* var_base = fingerprints.var_row(0);
+  const long long* presence_base =
+      (const long long*)fingerprints.presence_row(0);
+  for (; i + 4 <= count; i += 4) {
+    __m256i row = _mm256_set_epi64x(points[i + 3], points[i + 2],
+        points[i + 1], points[i]);
+    __m256i row_offset = _mm256_mul_epi32(row, _mm256_set1_epi64x(stride));
+    __m256i word_offset = _mm256_mul_epi32(row, _mm256_set1_epi64x(words));
+    __m256d sum = _mm256_setzero_pd();
+    __m256d df = _mm256_setzero_pd();
+    for (size_t a = 0; a < scan.size(); ++a) {
+      int ap = scan.ap[a];
+      __m256i word = _mm256_i64gather_epi64(presence_base,
+          _mm256_add_epi64(word_offset, _mm256_set1_epi64x(ap >> 6)), 8);
+      __m256i seen = _mm256_and_si256(
+          _mm256_srl_epi64(word, _mm_cvtsi32_si128(ap & 63)), low_bit);
+      __m256d mask = _mm256_castsi256_pd(_mm256_cmpeq_epi64(seen, low_bit));
+      __m256i index = _mm256_add_epi64(row_offset, _mm256_set1_epi64x(ap));
+      __m256d mean = _mm256_i64gather_pd(mean_base, index, 8);
+      __m256d std_dev =
+          _mm256_sqrt_pd(_mm256_i64gather_pd(var_base, index, 8));
+      __m256d z = _mm256_div_pd(
+          _mm256_sub_pd(_mm256_set1_pd(scan.signal[a]), mean), std_dev);
+      sum = _mm256_add_pd(sum, _mm256_and_pd(mask, _mm256_mul_pd(z, z)));
+      df = _mm256_add_pd(df, _mm256_and_pd(mask, one));
+    }
+    _mm256_storeu_pd(&sums[i], sum);
+    _mm_storeu_si128((__m128i*)&dfs[i], _mm256_cvttpd_epi32(df));
+  }
+  if (i < count) {
+    MahalanobisScoresSSE2(fingerprints, scan, points + i, count - i,
+        sums + i, dfs + i);
+  }
+}
+#endif // MAHALANOBIS_X86
+
+#ifdef MAHALANOBIS_NEON
+void MahalanobisScoresNEON(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs) {
+  const float64x2_t one = vdupq_n_f64(1.0);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    const double* mean0 = fingerprints.mean_row(points[i]);
+    const double* mean1 = fingerprints.mean_row(points[i + 1]);
+    const double* var0 = fingerprints.var_row(points[i]);
+    const double* var1 = fingerprints.var_row(points[i + 1]);
+    float64x2_t sum = vdupq_n_f64(0);
+    float64x2_t df = vdupq_n_f64(0);
+    for (size_t a = 0; a < scan.size(); ++a) {
+      int ap = scan.ap[a];
+      uint64_t bit = (uint64_t)1 << (ap & 63);
+      uint64_t word0 = PresenceWord(fingerprints, points[i], ap);
+      uint64_t word1 = PresenceWord(fingerprints, points[i + 1], ap);
+      uint64_t seen[2] = {
+        -(uint64_t)((word0 & bit) != 0), -(uint64_t)((word1 & bit) != 0)
+      };
+      uint64x2_t mask = vld1q_u64(seen);
+      double mean_lanes[2] = { mean0[ap], mean1[ap] };
+      double var_lanes[2] = { var0[ap], var1[ap] };
+      float64x2_t z = vdivq_f64(
+          vsubq_f64(vdupq_n_f64(scan.signal[a]), vld1q_f64(mean_lanes)),
+          vsqrtq_f64(vld1q_f64(var_lanes)));
+      // Multiply and add separately, vfmaq would round once.
+      float64x2_t z2 = vmulq_f64(z, z);
+      sum = vaddq_f64(sum, vreinterpretq_f64_u64(
+          vandq_u64(mask, vreinterpretq_u64_f64(z2))));
+      df = vaddq_f64(df, vreinterpretq_f64_u64(
+          vandq_u64(mask, vreinterpretq_u64_f64(one))));
+    }
+    vst1q_f64(&sums[i], sum);
+    dfs[i] = (int)vgetq_lane_f64(df, 0);
+    dfs[i + 1] = (int)vgetq_lane_f64(df, 1);
+  }
+  if (i < count) {
+    MahalanobisScoresScalar(fingerprints, scan, points + i, count - i,
+        sums + i, dfs + i);
+  }
+}
+#endif // MAHALANOBIS_NEON
+
+struct KernelChoice {
+  MahalanobisKernel kernel;
+  const char* name;
+};
+
+KernelChoice PickKernel() {
+#if defined(MAHALANOBIS_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return { MahalanobisScoresAVX2, "avx2" };
+  }
+  return { MahalanobisScoresSSE2, "sse2" };
+#elif defined(MAHALANOBIS_NEON)
+  return { MahalanobisScoresNEON, "neon" };
+#else
+  return { MahalanobisScoresScalar, "scalar" };
+#endif
+}
+
+const KernelChoice& Kernel() {
+  static const KernelChoice choice = PickKernel();
+  return choice;
+}
+
+} // anonymous namespace
+
+void MahalanobisScoresScalar(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs) {
+  for (size_t i = 0; i < count; ++i) {
+    const double* mean = fingerprints.mean_row(points[i]);
+    const double* var = fingerprints.var_row(points[i]);
+    const uint64_t* seen = fingerprints.presence_row(points[i]);
+    double sum = 0;
+    int df = 0;
+    for (size_t a = 0; a < scan.size(); ++a) {
+      int ap = scan.ap[a];
+      if (not FingerprintStore::Seen(seen, ap)) {
+        continue;
+      }
+      double dist_mean = (scan.signal[a] - mean[ap]) / sqrt(var[ap]);
+      sum += dist_mean * dist_mean;
+      df += 1;
+    }
+    sums[i] = sum;
+    dfs[i] = df;
+  }
+}
+
+bool MahalanobisScoreBounded(const FingerprintStore& fingerprints,
+    const InternedScan& scan, int point, double bound, double* sum) {
+  const double* mean = fingerprints.mean_row(point);
+  const double* var = fingerprints.var_row(point);
+  const uint64_t* seen = fingerprints.presence_row(point);
+  double partial = 0;
+  for (size_t a = 0; a < scan.size(); ++a) {
+    int ap = scan.ap[a];
+    if (not FingerprintStore::Seen(seen, ap)) {
+      continue;
+    }
+    double dist_mean = (scan.signal[a] - mean[ap]) / sqrt(var[ap]);
+    partial += dist_mean * dist_mean;
+    if (partial > bound) {
+      return false;
+    }
+  }
+  *sum = partial;
+  return true;
+}
+
+void MahalanobisScores(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs) {
+  Kernel().kernel(fingerprints, scan, points, count, sums, dfs);
+}
+
+const char* MahalanobisKernelName() {
+  return Kernel().name;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef MAHALANOBIS_KERNEL_H
+#define MAHALANOBIS_KERNEL_H
+
+#include "common_utils.h"
+#include "fingerprint_store.h"
+
+namespace wins {
+
+// Computes, for each of the count points, the sum of squared z-scores of the
+// scan against the point's fingerprint (sums) and the number of scanned APs
+// the point has seen (dfs). APs a point has never seen are skipped.
+//
+// A z-score is (signal - mean) / sqrt(var), rounded the way ProbabilityStat
+// rounds it, and every implementation accumulates a point's APs in scan
+// order with the same operations. So all kernels produce bit-identical sums
+// to each other and to the Map::Stats path.
+typedef void (*MahalanobisKernel)(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs);
+
+// Dispatches to the widest kernel the CPU supports, picked on first use.
+void MahalanobisScores(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs);
+void MahalanobisScoresScalar(const FingerprintStore& fingerprints,
+    const InternedScan& scan, const int* points, size_t count,
+    double* sums, int* dfs);
+const char* MahalanobisKernelName();
+
+// Scores a single point like MahalanobisScoresScalar, but gives up and
+// returns false as soon as the partial sum exceeds bound. A completed sum is
+// bit-identical to the one the batch kernels produce.
+bool MahalanobisScoreBounded(const FingerprintStore& fingerprints,
+    const InternedScan& scan, int point, double bound, double* sum);
+
+}
+
+#endif // MAHALANOBIS_KERNEL_H
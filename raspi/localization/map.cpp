@@ -1,4 +1,5 @@
 #include <cmath>
+#include <cstdio>
 #include <fstream>
 #include <limits>
 #include <stdexcept>
@@ -13,6 +14,7 @@
 #include "location.h"
 #include "navigation.h"
 #include "map.h"
+#include "scan_store.h"
 
 namespace wins {
 
@@ -22,6 +24,13 @@ condition_variable Map::navmode_changed_;
 vector<kdtree::node<Point*>*> Map::likely_points_;
 vector<unique_ptr<Point>> Map::all_points_;
 unique_ptr<kdtree::kdtree<Point*>> Map::tree_;
+unique_ptr<GridIndex> Map::grid_;
+WalkGraph Map::graph_;
+Landmarks Map::landmarks_;
+ContractionHierarchy Map::hierarchy_;
+PoiSets Map::pois_;
+FingerprintStore Map::fingerprints_;
+unique_ptr<FlatMap> Map::flat_map_;
 
 thread Map::navigation_thread_;
 bool Map::terminate_ = false;
@@ -31,8 +40,13 @@ inline bool file_exists(const std::string& name) {
   return (stat (name.c_str(), &buffer) == 0);
 }
 
+inline bool ends_with(const string& s, const string& suffix) {
+  return s.size() >= suffix.size() and
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 void Map::MainLoop() {
-  Map::InitMap(Global::MapFile);
+  Map::InitMap(Global::MapFile, Location::ComputePool());
 	Location::Init();
   while(not terminate_) {
     Location::UpdateEstimate();
@@ -71,48 +85,178 @@ void Map::BlockUntilNavigating() {
   }
 }
 
-void Map::InitMap(string filename) {
+namespace {
+  // Runs the kd-tree's parallel work on pool, or on the calling thread if
+  // pool is null.
+  kdtree::runner PoolRunner(WorkerPool* pool) {
+    if (pool == nullptr) {
+      return kdtree::runner();
+    }
+    return [pool](size_t count, const function<void(size_t)>& body) {
+      RunChunks(pool, count, body);
+    };
+  }
+
+  int32_t NearestNodeIndex(double x, double y) {
+    return Map::NodeIndex(Map::NodeNearest(x, y));
+  }
+} // anonymous namespace
+
+void Map::BuildTree(WorkerPool* pool) {
+  // The grid points into the old tree.
+  grid_.reset();
+  tree_.reset(new kdtree::kdtree<Point*>(&all_points_, PoolRunner(pool)));
+  if (Global::MapIndexKind == MAP_INDEX_GRID) {
+    grid_ = GridIndex::TryBuild(*tree_);
+  }
+}
+
+double Map::WalkRadius() {
+  return NEIGHBOR_RADIUS * Global::Scale;
+}
+
+void Map::LoadGraph(const string& filename) {
+  if (not graph_.Load(WalkGraph::FileFor(filename), *tree_, WalkRadius())) {
+    graph_.Build(*tree_, WalkRadius());
+  }
+}
+
+void Map::LoadLandmarks(const string& filename) {
+  if (not landmarks_.Load(Landmarks::FileFor(filename), graph_)) {
+    landmarks_.Clear();
+  }
+}
+
+void Map::LoadPois(const string& filename) {
+  pois_.Load(PoiSets::FileFor(filename), NearestNodeIndex);
+}
+
+void Map::LoadHierarchy(const string& filename) {
+  if (not hierarchy_.Load(ContractionHierarchy::FileFor(filename), graph_)) {
+    hierarchy_.Clear();
+  }
+}
+
+void Map::InitMap(string filename, WorkerPool* pool) {
+  if (FlatMap::IsFlatMap(filename)) {
+    // The fingerprints are used straight from the mapped file, only the
+    // points themselves and the kd-tree are built on load.
+    unique_ptr<FlatMap> flat_map(new FlatMap(filename));
+    all_points_ = flat_map->Points();
+    BuildTree(pool);
+    LoadGraph(filename);
+    LoadLandmarks(filename);
+    LoadHierarchy(filename);
+    LoadPois(filename);
+    fingerprints_.Borrow(*flat_map);
+    flat_map_ = move(flat_map);
+    likely_points_ = tree_->radius_nearest(all_points_[0].get(),
+        numeric_limits<double>::max());
+    return;
+  }
+
   ifstream is(filename, ios::binary);
   cereal::BinaryInputArchive archive(is);
 
   archive(all_points_);
   is.close();
+  // Maps from before POINT_VERSION 3 still carry their raw scans, which the
+  // estimators never read.
+  for (auto& point : all_points_) {
+    vector<vector<Result>>().swap(point->scans);
+  }
 
   //for(auto& p : all_points_){
   //  cout << p->scale_x << "," << p->scale_y << "\n";
   //}
 
-  tree_.reset(new kdtree::kdtree<Point*>(&all_points_));
+  BuildTree(pool);
+  LoadGraph(filename);
+  LoadLandmarks(filename);
+  LoadHierarchy(filename);
+  LoadPois(filename);
+  fingerprints_.Build(all_points_);
+  flat_map_.reset();
   likely_points_ = tree_->radius_nearest(all_points_[0].get(),
       numeric_limits<double>::max());
 }
 
-void Map::TestInitMap(vector<unique_ptr<Point>>&& all_points) {
+void Map::TestInitMap(vector<unique_ptr<Point>>&& all_points,
+    WorkerPool* pool) {
   all_points_ = move(all_points);
-  tree_.reset(new kdtree::kdtree<Point*>(&all_points_));
+  BuildTree(pool);
+  graph_.Build(*tree_, WalkRadius());
+  landmarks_.Clear();
+  hierarchy_.Clear();
+  pois_.Clear();
+  fingerprints_.Build(all_points_);
+  flat_map_.reset();
   likely_points_ = tree_->radius_nearest(all_points_[0].get(),
       numeric_limits<double>::max());
 }
 
+void Map::TestLoadPois(const string& filename) {
+  pois_.Load(filename, NearestNodeIndex);
+}
+
 void Map::TryConvertJSONMap(string in_filename, string out_filename) {
-  ifstream is(in_filename);
   if (not file_exists(in_filename)) {
     throw runtime_error("Map file does not exist");
   }
-  cereal::JSONInputArchive in_archive(is);
-  in_archive(all_points_);
-  is.close();
+  vector<unique_ptr<Point>> points;
+  if (ends_with(in_filename, ".json")) {
+    ifstream is(in_filename);
+    cereal::JSONInputArchive in_archive(is);
+    in_archive(points);
+  } else {
+    ifstream is(in_filename, ios::binary);
+    cereal::BinaryInputArchive in_archive(is);
+    in_archive(points);
+  }
 
-  ofstream os(out_filename);
+  WriteMap(out_filename, points);
+}
+
+void Map::WriteMap(string filename, const vector<unique_ptr<Point>>& points) {
+  // The raw scans go to a side-car that only the evaluation modes read.
+  bool has_scans = any_of(points.begin(), points.end(),
+      [](const unique_ptr<Point>& point) { return not point->scans.empty(); });
+  if (has_scans) {
+    ScanStore::Write(ScanStore::FileFor(filename), points);
+  } else {
+    // A side-car left from an earlier map by this name would be paired
+    // with the wrong points.
+    remove(ScanStore::FileFor(filename).c_str());
+  }
+  // InitMap builds the same tree from the points it reads back, so the
+  // graph matches it.
+  kdtree::kdtree<Point*> tree(&points);
+  WalkGraph graph;
+  graph.Build(tree, WalkRadius());
+  graph.Write(WalkGraph::FileFor(filename));
+  Landmarks landmarks;
+  landmarks.Build(graph, LANDMARK_COUNT);
+  landmarks.Write(Landmarks::FileFor(filename));
+
+  if (ends_with(filename, ".wmap")) {
+    FingerprintStore fingerprints;
+    fingerprints.Build(points);
+    FlatMap::Write(filename, points, fingerprints);
+    return;
+  }
+  ofstream os(filename, ios::binary);
   cereal::BinaryOutputArchive out_archive(os);
-  out_archive(all_points_);
+  out_archive(points);
   os.close();
 }
 
 void Map::UpdateLikelyPoints(double radius) {
   auto current = Location::GetCurrentNode();
   auto from = current == nullptr ? all_points_[0].get() : current->point;
-  likely_points_ = tree_->radius_nearest(from, radius);
+  // The estimators do not care about the order of the likely points, so
+  // skip the sort.
+  likely_points_.clear();
+  tree_->radius_nearest(from->x, from->y, radius, likely_points_, false);
   //printf("-------\n%3s %3s\n", "X", "Y");
   //if (current != nullptr) {
   //  printf("%3f %3f\n", current->point->x, current->point->y);
@@ -126,27 +270,55 @@ void Map::UpdateLikelyPoints(double radius) {
 
 vector<kdtree::node<Point*>*> Map::NodesInRadius(kdtree::node<Point*>* node,
     const double radius) {
-  return tree_->radius_nearest(node, radius);
+  vector<kdtree::node<Point*>*> nodes;
+  NodesInRadius(node, radius, nodes);
+  return nodes;
+}
+
+void Map::NodesInRadius(kdtree::node<Point*>* node, const double radius,
+    vector<kdtree::node<Point*>*>& nodes) {
+  nodes.clear();
+  if (grid_) {
+    grid_->RadiusNearest(node->x, node->y, radius, nodes);
+  } else {
+    tree_->radius_nearest(node->x, node->y, radius, nodes);
+  }
 }
 
 ProbabilityStat Map::Stats(const Point* p, string mac, int signal) {
-  auto mac_info_iter = p->info.find(mac);
-  if (mac_info_iter == p->info.end()) {
+  int ap = fingerprints_.ApId(mac);
+  if (ap < 0 or not fingerprints_.Seen(p->id, ap)) {
     // TODO: Handle error.
     return ProbabilityStat(-1, -1, -1);
   }
-  auto&& mac_info = (*mac_info_iter).second;
 
-  return ProbabilityStat(mac_info.mean, mac_info.var, signal);
+  return ProbabilityStat(fingerprints_.mean_row(p->id)[ap],
+      fingerprints_.var_row(p->id)[ap], signal);
 }
 
 const vector<kdtree::node<Point*>*>& Map::CurrentLikelyPoints() {
   return likely_points_;
 }
 
+void Map::NodesNearest(const vector<MapCoord>& queries,
+    vector<kdtree::node<Point*>*>& nodes, WorkerPool* pool) {
+  tree_->nearest(queries, nodes, PoolRunner(pool));
+}
+
+void Map::NodesInRadius(const vector<kdtree::node<Point*>*>& from,
+    const double radius, vector<vector<kdtree::node<Point*>*>>& nodes,
+    WorkerPool* pool) {
+  tree_->radius_nearest(from, radius, nodes, PoolRunner(pool));
+}
+
 kdtree::node<Point*>* Map::NodeNearest(double x, double y) {
-  Point p({ x, y });
-  return tree_->nearest(&p);
+  if (grid_) {
+    auto node = grid_->Nearest(x, y);
+    if (node != nullptr) {
+      return node;
+    }
+  }
+  return tree_->nearest(x, y);
 }
 
 }
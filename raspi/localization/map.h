@@ -8,9 +8,17 @@
 #include <unordered_map>
 
 #include "common_utils.h"
+#include "contraction_hierarchy.h"
+#include "fingerprint_store.h"
+#include "flat_map.h"
+#include "grid_index.h"
+#include "poi_sets.h"
 #include "point.h"
 #include "kdtree/kdtree.hpp"
+#include "landmarks.h"
 #include "probability_stat.h"
+#include "walk_graph.h"
+#include "worker_pool.h"
 
 namespace wins {
 
@@ -20,6 +28,12 @@ enum NavMode {
   NAV_MODE_LOCATE
 };
 
+// A location to search the map from.
+struct MapCoord {
+  double x;
+  double y;
+};
+
 class Map {
  private:
   static mutex navmode_mutex_;
@@ -28,10 +42,38 @@ class Map {
   static vector<kdtree::node<Point*>*> likely_points_;
   static vector<unique_ptr<Point>> all_points_;
   static unique_ptr<kdtree::kdtree<Point*>> tree_;
+  // Null when the kd-tree is searched instead.
+  static unique_ptr<GridIndex> grid_;
+  static WalkGraph graph_;
+  // Empty unless the map file has a landmarks side-car matching graph_.
+  static Landmarks landmarks_;
+  // Empty unless the map file has a hierarchy side-car matching graph_.
+  static ContractionHierarchy hierarchy_;
+  static PoiSets pois_;
+  static FingerprintStore fingerprints_;
+  // Backs fingerprints_ when the map was loaded from a flat map file.
+  static unique_ptr<FlatMap> flat_map_;
   static thread navigation_thread_;
   static bool terminate_;
 
   static void MainLoop();
+  // Builds tree_ over all_points_, forking large subtrees onto pool when it
+  // is not null. all_points_ keeps its order. Also builds grid_ when
+  // Global::MapIndexKind asks for it and the map allows it.
+  static void BuildTree(WorkerPool* pool);
+  // Loads graph_ from the side-car of filename if it matches tree_, and
+  // builds it otherwise.
+  static void LoadGraph(const string& filename);
+  // Loads landmarks_ from the side-car of filename if it matches graph_,
+  // and clears them otherwise. They are only computed by WriteMap.
+  static void LoadLandmarks(const string& filename);
+  // Loads hierarchy_ from the side-car of filename if it matches graph_, and
+  // clears it otherwise. It is only built by the contract_map test mode.
+  static void LoadHierarchy(const string& filename);
+  // Loads pois_ from the side-car of filename, if any.
+  static void LoadPois(const string& filename);
+  // Nodes within this distance are joined in graph_.
+  static double WalkRadius();
 
  public:
   static void StartNavigationThread();
@@ -40,18 +82,70 @@ class Map {
   static void SetNavMode(NavMode mode);
   static bool IsNavigating();
   static void BlockUntilNavigating();
-  static void InitMap(string filename);
-  static void TestInitMap(vector<unique_ptr<Point>>&& all_points);
+  // Loads either a flat map (see flat_map.h) or a cereal binary map.
+  static void InitMap(string filename, WorkerPool* pool = nullptr);
+  static void TestInitMap(vector<unique_ptr<Point>>&& all_points,
+      WorkerPool* pool = nullptr);
+  // Replaces the POI sets with the ones in filename, for tests on maps made
+  // by TestInitMap. InitMap reads them from the PoiSets side-car.
+  static void TestLoadPois(const string& filename);
+  // Reads a JSON map, or a cereal binary map unless in_filename ends in
+  // .json, and writes it with WriteMap.
   static void TryConvertJSONMap(string in_filename, string out_filename);
+  // Writes a flat map if filename ends in .wmap or a cereal binary map
+  // otherwise. Raw survey scans, if any, are written to the ScanStore
+  // side-car of filename, and the WalkGraph and its Landmarks to their own
+  // side-cars.
+  static void WriteMap(string filename,
+      const vector<unique_ptr<Point>>& points);
   static void UpdateLikelyPoints(double radius);
   static vector<kdtree::node<Point*>*> NodesInRadius(
       kdtree::node<Point*>* node, const double radius);
+  // Same as above into a reused buffer, which is cleared first.
+  static void NodesInRadius(kdtree::node<Point*>* node, const double radius,
+      vector<kdtree::node<Point*>*>& nodes);
   static ProbabilityStat Stats(const Point* p, string mac, int signal);
   static const vector<kdtree::node<Point*>*>& CurrentLikelyPoints();
   static const vector<unique_ptr<Point>>& all_points() {
     return all_points_;
   }
+  static const FingerprintStore& Fingerprints() {
+    return fingerprints_;
+  }
   static kdtree::node<Point*>* NodeNearest(double x, double y);
+  // Batch forms of NodeNearest and NodesInRadius for offline tools. Queries
+  // are searched in Morton order on pool, if not null, and the results are
+  // stored in the order of the queries. They always search the kd-tree, so
+  // of several nodes at the same distance they may pick another one than
+  // the grid index would.
+  static void NodesNearest(const vector<MapCoord>& queries,
+      vector<kdtree::node<Point*>*>& nodes, WorkerPool* pool = nullptr);
+  static void NodesInRadius(const vector<kdtree::node<Point*>*>& from,
+      const double radius, vector<vector<kdtree::node<Point*>*>>& nodes,
+      WorkerPool* pool = nullptr);
+  static bool UsesGridIndex() {
+    return grid_ != nullptr;
+  }
+  static const WalkGraph& Graph() {
+    return graph_;
+  }
+  static const Landmarks& RouteLandmarks() {
+    return landmarks_;
+  }
+  // Not const, queries keep their search state in it.
+  static ContractionHierarchy& Hierarchy() {
+    return hierarchy_;
+  }
+  static const PoiSets& Pois() {
+    return pois_;
+  }
+  // A node's number in Graph(), and back.
+  static int32_t NodeIndex(const kdtree::node<Point*>* node) {
+    return node - tree_->root();
+  }
+  static kdtree::node<Point*>* NodeAt(int32_t index) {
+    return tree_->at(index);
+  }
 };
 
 }
@@ -1,9 +1,10 @@
 #include <cassert>
-#include <queue>
+#include <limits>
 #include <stdexcept>
 
 #include "global.h"
 #include "location.h"
+#include "log.h"
 #include "map.h"
 #include "navigation.h"
 
@@ -12,17 +13,17 @@ namespace wins {
 using namespace std;
 
 #define MULTIPLIER 10
-#define NEIGHBOR_RADIUS 2.5
-
-struct PriorityNode {
-  kdtree::node<Point*>* node;
-  double priority;
-};
 
 kdtree::node<Point*>* Navigation::destination_node_ = nullptr;
 vector<kdtree::node<Point*>*>::reverse_iterator Navigation::current_start_;
 vector<kdtree::node<Point*>*> Navigation::current_route_;
-unordered_set<kdtree::node<Point*>*> Navigation::nearby_route_;
+vector<bool> Navigation::corridor_;
+vector<int32_t> Navigation::corridor_nodes_;
+vector<int32_t> Navigation::route_position_;
+vector<int32_t> Navigation::poi_goals_;
+RouteSearch Navigation::search_;
+RouteReplanner Navigation::replanner_;
+vector<int32_t> Navigation::route_;
 bool Navigation::navigating_ = false;
 mutex Navigation::route_mutex;
 
@@ -46,6 +47,10 @@ bool Navigation::TrySetDestinationFromCoords(string s) {
   int n_yi = (int)(n->point->y * MULTIPLIER);
 
   if (in_xi == n_xi and in_yi == n_yi) {
+    {
+      lock_guard<mutex> lock(route_mutex);
+      poi_goals_.clear();
+    }
     destination_node_ = n;
     navigating_ = true;
     return true;
@@ -53,7 +58,45 @@ bool Navigation::TrySetDestinationFromCoords(string s) {
   return false;
 }
 
+bool Navigation::TrySetDestinationFromPoi(string name) {
+  auto goals = Map::Pois().Find(name);
+  if (goals == nullptr or goals->empty()) {
+    return false;
+  }
+  {
+    lock_guard<mutex> lock(route_mutex);
+    poi_goals_ = *goals;
+  }
+  navigating_ = true;
+  return true;
+}
+
+void Navigation::RouteToNearest(kdtree::node<Point*>* current_node,
+    const vector<int32_t>& goals) {
+  // One search towards all of the set, bounded by its closest member.
+  bool found = search_.FindRouteToNearest(Map::Graph(),
+      Map::NodeIndex(current_node), goals, [&goals](int32_t node) {
+        double bound = numeric_limits<double>::infinity();
+        for (auto goal : goals) {
+          bound = min(bound, max(Map::NodeAt(node)->distance(Map::NodeAt(goal)),
+              Map::RouteLandmarks().LowerBound(node, goal)));
+        }
+        return bound;
+      }, route_);
+  if (not found) {
+    FILE_LOG(logERROR) << "No route to the destination.";
+    navigating_ = false;
+  } else {
+    destination_node_ = Map::NodeAt(route_.front());
+  }
+  PublishRoute();
+}
+
 void Navigation::ResetDestination() {
+  {
+    lock_guard<mutex> lock(route_mutex);
+    poi_goals_.clear();
+  }
   destination_node_ = nullptr;
 }
 
@@ -74,18 +117,33 @@ void Navigation::UpdateRoute() {
     return;
   }
 
+  vector<int32_t> goals;
+  {
+    lock_guard<mutex> lock(route_mutex);
+    goals.swap(poi_goals_);
+  }
+  if (not goals.empty()) {
+    RouteToNearest(current_node, goals);
+    return;
+  }
+
   // Check if current point is in route cache.
-  if (current_route_.size() > 0 and nearby_route_.count(current_node)) {
+  int32_t current_index = Map::NodeIndex(current_node);
+  if (current_route_.size() > 0 and
+      (size_t)current_index < corridor_.size() and corridor_[current_index]) {
     if (current_node->distance(destination_node_) < NEIGHBOR_RADIUS) {
       Global::SetEventFlag(WINS_EVENT_DEST_REACHED);
       navigating_ = false;
       return;
     }
-    auto node_in_path_iter = find(current_start_, current_route_.rend(),
-        current_node);
-    if (node_in_path_iter != current_route_.rend()) {
+    // Only moving on along the route counts, current_route_ runs from the
+    // destination back to where the route started.
+    int32_t position = route_position_[current_index];
+    int32_t start_position = current_route_.rend() - current_start_ - 1;
+    if (position >= 0 and position <= start_position) {
       lock_guard<mutex> lock(route_mutex);
-      current_start_ = node_in_path_iter;
+      current_start_ = current_route_.rbegin() +
+          (current_route_.size() - 1 - position);
       return;
     }
     //  for (auto node_iter = current_route_.rbegin();
@@ -109,75 +167,75 @@ void Navigation::UpdateRoute() {
   auto target_node = destination_node_;
   assert(target_node != nullptr);
 
-  auto compareFunc = [](PriorityNode a, PriorityNode b) {
-    return a.priority > b.priority;
-  };
-  typedef priority_queue<PriorityNode, vector<PriorityNode>,
-      decltype(compareFunc)> pqueue;
-
-  unordered_map<kdtree::node<Point*>*, kdtree::node<Point*>*> came_from;
-  unordered_map<kdtree::node<Point*>*, double> cost_so_far;
-  pqueue frontier(compareFunc);
-
-  frontier.push({ Location::GetCurrentNode(), 0 });
-  came_from[current_node] = current_node;
-  cost_so_far[current_node] = 0;
-
-  while (not frontier.empty()) {
-    // Current iteration node.
-    auto current = frontier.top();
-    frontier.pop();
-
-    if (current.node == target_node) {
-      break;
-    }
+  // A contraction hierarchy answers from scratch faster than the replanner
+  // repairs its search, so it is used whenever the map comes with one.
+  bool found;
+  auto& hierarchy = Map::Hierarchy();
+  if (not hierarchy.empty()) {
+    found = hierarchy.FindRoute(Map::NodeIndex(current_node),
+        Map::NodeIndex(target_node), route_);
+  } else {
+    found = replanner_.FindRoute(Map::Graph(), Map::NodeIndex(current_node),
+        Map::NodeIndex(target_node), [](int32_t from, int32_t to) {
+          return max(Map::NodeAt(from)->distance(Map::NodeAt(to)),
+              Map::RouteLandmarks().LowerBound(from, to));
+        }, route_);
+  }
 
-    auto neighbors = Map::NodesInRadius(current.node,
-        NEIGHBOR_RADIUS * Global::Scale);
-    auto rem_iter = neighbors.begin();
-    for (auto n = neighbors.begin(); n != neighbors.end(); ++n) {
-      if (*n == current.node) {
-        rem_iter = n;
-        //cout << "Removed current\n";
-      }
-    }
-    neighbors.erase(rem_iter);
-    //printf("%3.0f %3.0f\n", current.node->point->x, current.node->point->y);
-    for (size_t i = 0; i < neighbors.size(); ++i) {
-      kdtree::node<Point*>* next = neighbors[i];
-      double new_cost = cost_so_far[current.node] + current.node->distance(next);
-      //printf("%3.0f %3.0f %5.3f", next->point->x, next->point->y, new_cost);
-      if (cost_so_far.count(next) == 0 ||
-          new_cost < cost_so_far[next]) {
-        cost_so_far[next] = new_cost;
-        double priority = new_cost + next->distance(target_node);
-        //printf(" %5.3f", priority);
-        frontier.push(PriorityNode{ next, priority });
-        came_from[next] = current.node;
-      }
-      //cout << "\n";
-    }
-    //cout << "\n";
+  if (not found) {
+    FILE_LOG(logERROR) << "No route to the destination.";
   }
+  PublishRoute();
+}
 
+void Navigation::PublishRoute() {
   lock_guard<mutex> lock(route_mutex);
   current_route_.clear();
-  nearby_route_.clear();
-  for (auto node = target_node; node != current_node; node = came_from[node]) {
-    current_route_.push_back(node);
-    for (auto nearby : Map::NodesInRadius(node, NEIGHBOR_RADIUS)) {
-      nearby_route_.insert(nearby);
-    }
+  MarkCorridor();
+  if (route_.empty()) {
+    current_start_ = current_route_.rend();
+    return;
   }
-  current_route_.push_back(current_node);
-  for (auto nearby : Map::NodesInRadius(current_node, NEIGHBOR_RADIUS)) {
-    nearby_route_.insert(nearby);
+  // route_ runs from the target back to the current node.
+  for (auto node : route_) {
+    current_route_.push_back(Map::NodeAt(node));
   }
 
   current_start_ = current_route_.rbegin();
   Global::SetEventFlag(WINS_EVENT_ROUTE_CHANGE);
 }
 
+void Navigation::MarkCorridor() {
+  auto& graph = Map::Graph();
+  if (corridor_.size() != graph.num_nodes()) {
+    corridor_.assign(graph.num_nodes(), false);
+    route_position_.assign(graph.num_nodes(), -1);
+    corridor_nodes_.clear();
+  }
+  for (auto node : corridor_nodes_) {
+    corridor_[node] = false;
+    route_position_[node] = -1;
+  }
+  corridor_nodes_.clear();
+
+  for (size_t i = 0; i < route_.size(); ++i) {
+    int32_t node = route_[i];
+    route_position_[node] = i;
+    if (not corridor_[node]) {
+      corridor_[node] = true;
+      corridor_nodes_.push_back(node);
+    }
+    for (int32_t e = graph.edges_begin(node); e < graph.edges_end(node);
+        ++e) {
+      int32_t next = graph.target(e);
+      if (not corridor_[next]) {
+        corridor_[next] = true;
+        corridor_nodes_.push_back(next);
+      }
+    }
+  }
+}
+
 vector<kdtree::node<Point*>*>::const_reverse_iterator Navigation::route_begin() {
   return current_route_.rbegin();
 }
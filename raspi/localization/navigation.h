@@ -6,20 +6,54 @@
 #include "common_utils.h"
 #include "kdtree/node.hpp"
 #include "point.h"
+#include "route_replanner.h"
+#include "route_search.h"
 
 namespace wins {
 
+// Nodes within this distance of each other are connected when routing.
+#define NEIGHBOR_RADIUS 2.5
+
 class Navigation {
  private:
   static kdtree::node<Point*>* destination_node_;
   static vector<kdtree::node<Point*>*>::reverse_iterator current_start_;
   static vector<kdtree::node<Point*>*> current_route_;
-  static unordered_set<kdtree::node<Point*>*> nearby_route_;
+  // Walk graph nodes on or next to current_route_, by node number, and the
+  // numbers set in it, to clear them before the next route.
+  static vector<bool> corridor_;
+  static vector<int32_t> corridor_nodes_;
+  // Index in current_route_ of every walk graph node, -1 if not on it.
+  static vector<int32_t> route_position_;
+  // Members of the POI set to route to the nearest of on the next
+  // UpdateRoute, guarded by route_mutex, and the search for them. Only the
+  // navigation thread searches.
+  static vector<int32_t> poi_goals_;
+  static RouteSearch search_;
+  // Route search state, kept so that replanning after the user moves only
+  // repairs the previous search, and its result.
+  static RouteReplanner replanner_;
+  static vector<int32_t> route_;
   static bool navigating_;
 
+  // Marks the nodes of route_ and their walk graph neighbors in corridor_,
+  // and their positions in route_position_.
+  static void MarkCorridor();
+  // Routes from current_node to the nearest of goals and makes that the
+  // destination. Stops navigating if none can be reached.
+  static void RouteToNearest(kdtree::node<Point*>* current_node,
+      const vector<int32_t>& goals);
+  // Makes route_ the current route, or clears the current route if route_
+  // is empty.
+  static void PublishRoute();
+
  public:
   static mutex route_mutex;
   static bool TrySetDestinationFromCoords(string s);
+  // Asks the next UpdateRoute to set the destination to the member of the
+  // named POI set (see poi_sets.h) nearest to the current node by walking
+  // distance. Returns false if there is no such set.
+  static bool TrySetDestinationFromPoi(string name);
   static void UpdateRoute();
   static void ResetDestination();
   static kdtree::node<Point*>* const GetDestination();
@@ -0,0 +1,36 @@
+#include <fstream>
+#include <sstream>
+
+#include "log.h"
+#include "poi_sets.h"
+
+namespace wins {
+
+void PoiSets::Load(const string& filename,
+    const function<int32_t(double, double)>& nearest_node) {
+  sets_.clear();
+  ifstream is(filename);
+  string line;
+  for (int line_number = 1; getline(is, line); ++line_number) {
+    istringstream fields(line);
+    string name;
+    double x;
+    double y;
+    string rest;
+    if (not (fields >> name) or name[0] == '#') {
+      continue;
+    }
+    if (not (fields >> x >> y) or fields >> rest) {
+      FILE_LOG(logERROR) << filename << ":" << line_number <<
+          ": expected <set name> <x> <y>";
+      continue;
+    }
+    auto& nodes = sets_[name];
+    int32_t node = nearest_node(x, y);
+    if (find(nodes.begin(), nodes.end(), node) == nodes.end()) {
+      nodes.push_back(node);
+    }
+  }
+}
+
+}
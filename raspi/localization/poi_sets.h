@@ -0,0 +1,48 @@
+#ifndef POI_SETS_H
+#define POI_SETS_H
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "common_utils.h"
+
+namespace wins {
+
+#define POI_SETS_SUFFIX ".poi"
+
+// Named sets of points of interest on a map, such as the restrooms or the
+// exits, each point snapped to the map node nearest to it. They are read
+// from a text side-car of the map file with one point per line:
+//
+//   <set name> <x> <y>
+//
+// Set names are single words, typed on the keypad to route to the nearest
+// point of the set. Blank lines and lines starting with # are skipped.
+class PoiSets {
+ private:
+  unordered_map<string, vector<int32_t>> sets_;
+
+ public:
+  // The side-car name used for a map file.
+  static string FileFor(const string& map_filename) {
+    return map_filename + POI_SETS_SUFFIX;
+  }
+
+  // Replaces the sets with the ones in filename, none if it is missing.
+  // nearest_node(x, y) gives the number of the map node nearest to a point.
+  // Malformed lines are logged and skipped.
+  void Load(const string& filename,
+      const function<int32_t(double, double)>& nearest_node);
+  void Clear() { sets_.clear(); }
+
+  // The nodes of a set, or null if there is no set by that name.
+  const vector<int32_t>* Find(const string& name) const {
+    auto set = sets_.find(name);
+    return set == sets_.end() ? nullptr : &set->second;
+  }
+  size_t size() const { return sets_.size(); }
+};
+
+}
+
+#endif // POI_SETS_H
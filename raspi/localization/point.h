@@ -14,7 +14,10 @@
 
 namespace wins {
 
-#define POINT_VERSION 2
+// Version 2 stored the raw survey scans inline. From version 3 they live in a
+// ScanStore side-car and Point::scans is only filled by the code that loads
+// it.
+#define POINT_VERSION 3
 
 struct MacInfo {
   double mean;
@@ -34,15 +37,17 @@ struct Point {
   vector<vector<Result>> scans;
   double scale_x;
   double scale_y;
+  // Dense index assigned when the map is loaded. Not serialized.
+  int id;
 
   template<class Archive>
   void serialize(Archive & archive, uint32_t const version) {
-    assert(version == POINT_VERSION);
-#ifdef DSCAN
-    archive(x, y, cost, info, scans, scale_x, scale_y);
-#else
-    archive(x, y, cost, info, scale_x, scale_y);
-#endif
+    assert(version == 2 or version == POINT_VERSION);
+    if (version == 2) {
+      archive(x, y, cost, info, scans, scale_x, scale_y);
+    } else {
+      archive(x, y, cost, info, scale_x, scale_y);
+    }
   }
 };
 
@@ -0,0 +1,133 @@
+#include <limits>
+
+#include "route_replanner.h"
+
+namespace wins {
+
+namespace {
+  const double kUnreached = numeric_limits<double>::infinity();
+} // anonymous namespace
+
+void RouteReplanner::Reset(const WalkGraph& graph, int32_t start,
+    int32_t goal) {
+  size_t num_nodes = graph.num_nodes();
+  if (stamp_.size() != num_nodes) {
+    stamp_.assign(num_nodes, 0);
+    cost_.resize(num_nodes);
+    lookahead_.resize(num_nodes);
+    open_.Resize(num_nodes);
+    generation_ = 0;
+  }
+  generation_ += 1;
+  if (generation_ == 0) {
+    // The stamps have wrapped around, old ones could look current again.
+    fill(stamp_.begin(), stamp_.end(), 0);
+    generation_ = 1;
+  }
+  open_.Clear();
+  graph_ = &graph;
+  graph_hash_ = graph.tree_hash();
+  graph_edges_ = graph.num_edges();
+  goal_ = goal;
+  last_start_ = start;
+  key_offset_ = 0;
+
+  Reach(goal);
+  lookahead_[goal] = 0;
+  open_.Push(goal, KeyFor(goal, start));
+}
+
+void RouteReplanner::Reach(int32_t node) {
+  stamp_[node] = generation_;
+  cost_[node] = kUnreached;
+  lookahead_[node] = kUnreached;
+}
+
+RouteReplanner::Key RouteReplanner::KeyFor(int32_t node, int32_t start) const {
+  double cost = min(cost_[node], lookahead_[node]);
+  return Key(cost + (*heuristic_)(start, node) + key_offset_, cost);
+}
+
+void RouteReplanner::Expand(int32_t start) {
+  auto& graph = *graph_;
+  while (not open_.empty() and
+      (open_.TopKey() < KeyFor(start, start) or
+       cost_[start] != lookahead_[start])) {
+    int32_t current = open_.Top();
+    Key key = KeyFor(current, start);
+    if (open_.TopKey() < key) {
+      // Queued before the start moved, its key has gone up since.
+      open_.Push(current, key);
+      continue;
+    }
+    open_.Pop();
+    expanded_ += 1;
+    cost_[current] = lookahead_[current];
+    for (int32_t e = graph.edges_begin(current); e < graph.edges_end(current);
+        ++e) {
+      int32_t next = graph.target(e);
+      if (not Reached(next)) {
+        Reach(next);
+      }
+      double new_cost = cost_[current] + graph.length(e);
+      if (new_cost < lookahead_[next]) {
+        lookahead_[next] = new_cost;
+        open_.Push(next, KeyFor(next, start));
+      }
+    }
+  }
+}
+
+bool RouteReplanner::FindRoute(const WalkGraph& graph, int32_t start,
+    int32_t goal, const function<double(int32_t, int32_t)>& heuristic,
+    vector<int32_t>& route) {
+  route.clear();
+  expanded_ = 0;
+  heuristic_ = &heuristic;
+  if (graph_ != &graph or graph_hash_ != graph.tree_hash() or
+      graph_edges_ != graph.num_edges() or
+      stamp_.size() != graph.num_nodes() or goal != goal_) {
+    Reset(graph, start, goal);
+  } else if (start != last_start_) {
+    key_offset_ += heuristic(last_start_, start);
+    last_start_ = start;
+  }
+  if (not Reached(start)) {
+    Reach(start);
+  }
+  Expand(start);
+  heuristic_ = nullptr;
+  if (cost_[start] == kUnreached) {
+    return false;
+  }
+
+  // Walk down the costs from the start. Every step lowers the cost to the
+  // goal, the bound only guards against rounding.
+  route.push_back(start);
+  for (size_t step = 0; route.back() != goal and step < stamp_.size();
+      ++step) {
+    int32_t current = route.back();
+    int32_t best = -1;
+    double best_cost = kUnreached;
+    for (int32_t e = graph.edges_begin(current); e < graph.edges_end(current);
+        ++e) {
+      int32_t next = graph.target(e);
+      if (Reached(next) and graph.length(e) + cost_[next] < best_cost) {
+        best = next;
+        best_cost = graph.length(e) + cost_[next];
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+    route.push_back(best);
+  }
+  if (route.back() != goal) {
+    route.clear();
+    return false;
+  }
+  reverse(route.begin(), route.end());
+  return true;
+}
+
+}
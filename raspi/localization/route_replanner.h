@@ -0,0 +1,72 @@
+#ifndef ROUTE_REPLANNER_H
+#define ROUTE_REPLANNER_H
+
+#include <cstdint>
+
+#include "common_utils.h"
+#include "indexed_heap.h"
+#include "walk_graph.h"
+
+namespace wins {
+
+// Incremental route planning towards a fixed goal from a moving start, after
+// D* Lite (Koenig and Likhachev, 2002). The search runs backwards from the
+// goal and keeps its state between calls, so when the start moves only the
+// part of the search tree the new start needs is expanded. Keys already on
+// the open set are not recomputed when the start moves, they are offset by
+// the distance the start has moved instead and fixed up lazily.
+//
+// Walk graph edges are symmetric and their lengths never change, so costs
+// from the goal only ever go down and no node has to be reopened.
+class RouteReplanner {
+ private:
+  // Open set order: estimated route length through a node, then its cost.
+  typedef pair<double, double> Key;
+
+  // The graph of the previous search. A map reload may rebuild a graph in
+  // place, so its tree hash and edge count are kept as well.
+  const WalkGraph* graph_ = nullptr;
+  uint64_t graph_hash_ = 0;
+  size_t graph_edges_ = 0;
+  int32_t goal_ = -1;
+  int32_t last_start_ = -1;
+  // Sum of the heuristic distances the start has moved since the goal was set.
+  double key_offset_ = 0;
+  // Cost from a node to the goal as last expanded (g), and the best cost
+  // through a neighbor seen since (rhs). A node is open while they differ.
+  vector<uint32_t> stamp_;
+  vector<double> cost_;
+  vector<double> lookahead_;
+  IndexedHeap<Key> open_;
+  uint32_t generation_ = 0;
+  size_t expanded_ = 0;
+  const function<double(int32_t, int32_t)>* heuristic_ = nullptr;
+
+  void Reset(const WalkGraph& graph, int32_t start, int32_t goal);
+  bool Reached(int32_t node) const { return stamp_[node] == generation_; }
+  void Reach(int32_t node);
+  Key KeyFor(int32_t node, int32_t start) const;
+  void Expand(int32_t start);
+
+ public:
+  // Finds the cheapest route from start to goal, reusing the previous search
+  // when the graph and goal are the ones of the last call. A graph rebuilt
+  // for other nodes since counts as another graph. heuristic(a, b)
+  // must be a consistent lower bound on the cost between nodes a and b, and
+  // the same function for as long as the goal does not change. The route is
+  // stored in route from goal back to start, both included. Returns false
+  // and leaves route empty if goal cannot be reached.
+  bool FindRoute(const WalkGraph& graph, int32_t start, int32_t goal,
+      const function<double(int32_t, int32_t)>& heuristic,
+      vector<int32_t>& route);
+
+  // Forgets the previous search, the next one starts from scratch.
+  void Clear() { graph_ = nullptr; }
+
+  // Number of nodes taken off the open set by the last call.
+  size_t expanded() const { return expanded_; }
+};
+
+}
+
+#endif // ROUTE_REPLANNER_H
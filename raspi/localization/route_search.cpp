@@ -0,0 +1,85 @@
+#include "route_search.h"
+
+namespace wins {
+
+void RouteSearch::Reset(size_t num_nodes) {
+  if (stamp_.size() != num_nodes) {
+    stamp_.assign(num_nodes, 0);
+    goal_stamp_.assign(num_nodes, 0);
+    cost_.resize(num_nodes);
+    parent_.resize(num_nodes);
+    open_.Resize(num_nodes);
+    generation_ = 0;
+  }
+  generation_ += 1;
+  if (generation_ == 0) {
+    // The stamps have wrapped around, old ones could look current again.
+    fill(stamp_.begin(), stamp_.end(), 0);
+    fill(goal_stamp_.begin(), goal_stamp_.end(), 0);
+    generation_ = 1;
+  }
+  open_.Clear();
+  expanded_ = 0;
+}
+
+bool RouteSearch::FindRoute(const WalkGraph& graph, int32_t start,
+    int32_t goal, const function<double(int32_t)>& heuristic,
+    vector<int32_t>& route) {
+  route.clear();
+  Reset(graph.num_nodes());
+  goal_stamp_[goal] = generation_;
+  return Search(graph, start, heuristic, route);
+}
+
+bool RouteSearch::FindRouteToNearest(const WalkGraph& graph, int32_t start,
+    const vector<int32_t>& goals, const function<double(int32_t)>& heuristic,
+    vector<int32_t>& route) {
+  route.clear();
+  Reset(graph.num_nodes());
+  for (auto goal : goals) {
+    goal_stamp_[goal] = generation_;
+  }
+  return Search(graph, start, heuristic, route);
+}
+
+bool RouteSearch::Search(const WalkGraph& graph, int32_t start,
+    const function<double(int32_t)>& heuristic, vector<int32_t>& route) {
+  stamp_[start] = generation_;
+  cost_[start] = 0;
+  parent_[start] = start;
+  open_.Push(start, heuristic(start));
+
+  int32_t goal = -1;
+  while (not open_.empty()) {
+    int32_t current = open_.Pop();
+    expanded_ += 1;
+    if (IsGoal(current)) {
+      goal = current;
+      break;
+    }
+    for (int32_t e = graph.edges_begin(current); e < graph.edges_end(current);
+        ++e) {
+      int32_t next = graph.target(e);
+      double new_cost = cost_[current] + graph.length(e);
+      if (not Reached(next)) {
+        stamp_[next] = generation_;
+      } else if (new_cost >= cost_[next]) {
+        continue;
+      }
+      cost_[next] = new_cost;
+      parent_[next] = current;
+      open_.Push(next, new_cost + heuristic(next));
+    }
+  }
+  if (goal < 0) {
+    return false;
+  }
+
+  for (int32_t node = goal; node != start; node = parent_[node]) {
+    route.push_back(node);
+  }
+  route.push_back(start);
+  return true;
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef ROUTE_SEARCH_H
+#define ROUTE_SEARCH_H
+
+#include <cstdint>
+
+#include "common_utils.h"
+#include "indexed_heap.h"
+#include "walk_graph.h"
+
+namespace wins {
+
+// A* over a WalkGraph. The cost and parent of every node are kept in arrays
+// indexed by node number that persist across searches. A generation stamp
+// tells which entries belong to the current search, so nothing is cleared or
+// allocated between searches once the arrays have grown to the graph. The
+// open set is an IndexedHeap, so the priority of an open node is lowered in
+// place rather than pushed again.
+class RouteSearch {
+ private:
+  vector<uint32_t> stamp_;
+  // Nodes the current search may end at carry its generation.
+  vector<uint32_t> goal_stamp_;
+  vector<double> cost_;
+  vector<int32_t> parent_;
+  IndexedHeap<double> open_;
+  uint32_t generation_ = 0;
+  size_t expanded_ = 0;
+
+  void Reset(size_t num_nodes);
+  // Whether node has been reached by the current search.
+  bool Reached(int32_t node) const { return stamp_[node] == generation_; }
+  bool IsGoal(int32_t node) const { return goal_stamp_[node] == generation_; }
+  // Runs A* from start to the nearest goal marked in goal_stamp_.
+  bool Search(const WalkGraph& graph, int32_t start,
+      const function<double(int32_t)>& heuristic, vector<int32_t>& route);
+
+ public:
+  // Finds the cheapest route from start to goal. heuristic(node) must not
+  // overestimate the cost from node to goal. The route is stored in route
+  // from goal back to start, both included. Returns false and leaves route
+  // empty if goal cannot be reached.
+  bool FindRoute(const WalkGraph& graph, int32_t start, int32_t goal,
+      const function<double(int32_t)>& heuristic, vector<int32_t>& route);
+  // Same as above, to whichever of goals is cheapest to reach, in a single
+  // search. heuristic(node) must not overestimate the cost from node to the
+  // nearest of goals. The route ends at that goal, route.front().
+  bool FindRouteToNearest(const WalkGraph& graph, int32_t start,
+      const vector<int32_t>& goals, const function<double(int32_t)>& heuristic,
+      vector<int32_t>& route);
+
+  // Number of nodes taken off the open set by the last search.
+  size_t expanded() const { return expanded_; }
+};
+
+}
+
+#endif // ROUTE_SEARCH_H
@@ -0,0 +1,86 @@
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "cereal/archives/binary.hpp"
+#include "cereal/types/vector.hpp"
+#include "scan_store.h"
+
+namespace wins {
+
+uint64_t ScanStore::PointsHash(const vector<unique_ptr<Point>>& points) {
+  // FNV-1a over the point coordinates in file order.
+  uint64_t hash = 14695981039346656037ULL;
+  for (auto& point : points) {
+    double coords[2] = { point->x, point->y };
+    auto bytes = reinterpret_cast<const unsigned char*>(coords);
+    for (size_t b = 0; b < sizeof(coords); ++b) {
+      hash = (hash ^ bytes[b]) * 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+ScanStore::ScanStore(const string& filename)
+    : is_(filename, ios::binary) {
+  if (not is_) {
+    throw runtime_error("Scan file does not exist");
+  }
+  char magic[sizeof(SCAN_STORE_MAGIC)];
+  uint64_t count = 0;
+  is_.read(magic, sizeof(magic));
+  is_.read(reinterpret_cast<char*>(&count), sizeof(count));
+  is_.read(reinterpret_cast<char*>(&points_hash_), sizeof(points_hash_));
+  if (not is_ or memcmp(magic, SCAN_STORE_MAGIC, sizeof(magic)) != 0) {
+    throw runtime_error("Not a scan file");
+  }
+  offsets_.resize(count + 1);
+  is_.read(reinterpret_cast<char*>(offsets_.data()),
+      offsets_.size() * sizeof(uint64_t));
+  if (not is_) {
+    throw runtime_error("Scan file is too short");
+  }
+  data_start_ = is_.tellg();
+}
+
+void ScanStore::Write(const string& filename,
+    const vector<unique_ptr<Point>>& points) {
+  ostringstream data;
+  vector<uint64_t> offsets = { 0 };
+  for (auto& point : points) {
+    {
+      cereal::BinaryOutputArchive archive(data);
+      archive(point->scans);
+    }
+    offsets.push_back(data.tellp());
+  }
+
+  ofstream os(filename, ios::binary);
+  uint64_t count = points.size();
+  uint64_t points_hash = PointsHash(points);
+  os.write(SCAN_STORE_MAGIC, sizeof(SCAN_STORE_MAGIC));
+  os.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  os.write(reinterpret_cast<const char*>(&points_hash), sizeof(points_hash));
+  os.write(reinterpret_cast<const char*>(offsets.data()),
+      offsets.size() * sizeof(uint64_t));
+  os << data.str();
+  if (not os) {
+    throw runtime_error("Could not write " + filename);
+  }
+}
+
+bool ScanStore::Matches(const vector<unique_ptr<Point>>& points) const {
+  return size() == points.size() and points_hash_ == PointsHash(points);
+}
+
+vector<vector<Result>> ScanStore::Load(size_t index) {
+  assert(index < size());
+  is_.clear();
+  is_.seekg(data_start_ + offsets_[index]);
+  vector<vector<Result>> scans;
+  cereal::BinaryInputArchive archive(is_);
+  archive(scans);
+  return scans;
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef SCAN_STORE_H
+#define SCAN_STORE_H
+
+#include <cstdint>
+#include <fstream>
+
+#include "common_utils.h"
+#include "point.h"
+#include "scan_result.h"
+
+namespace wins {
+
+#define SCAN_STORE_MAGIC "WINSSC2"
+#define SCAN_STORE_SUFFIX ".scans"
+
+// Side-car file holding the raw survey scans of a points file, which the
+// points file itself no longer carries. Layout:
+//
+//   magic     char[8]
+//   count     uint64_t              number of points
+//   hash      uint64_t              PointsHash of the points file
+//   offsets   uint64_t[count + 1]   where each point's scans start, relative
+//                                   to the end of the offsets
+//   scans     cereal binary vector<vector<Result>> per point, in the order of
+//             the points file
+//
+// Only the offsets are read on open, the scans of a point are read when
+// asked for. A points file rewritten since the store was written no longer
+// matches its count and hash, see Matches.
+class ScanStore {
+ private:
+  ifstream is_;
+  uint64_t points_hash_ = 0;
+  vector<uint64_t> offsets_;
+  uint64_t data_start_ = 0;
+
+  static uint64_t PointsHash(const vector<unique_ptr<Point>>& points);
+
+ public:
+  // Throws runtime_error if the file is missing or not a scan store.
+  explicit ScanStore(const string& filename);
+
+  // The side-car name used for a points file.
+  static string FileFor(const string& points_filename) {
+    return points_filename + SCAN_STORE_SUFFIX;
+  }
+  static void Write(const string& filename,
+      const vector<unique_ptr<Point>>& points);
+
+  size_t size() const { return offsets_.size() - 1; }
+  // Whether the store was written for these points, by count and
+  // coordinates.
+  bool Matches(const vector<unique_ptr<Point>>& points) const;
+  // Scans of the point at index in the points file.
+  vector<vector<Result>> Load(size_t index);
+};
+
+}
+
+#endif // SCAN_STORE_H
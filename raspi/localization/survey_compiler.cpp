@@ -0,0 +1,228 @@
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "survey_compiler.h"
+
+namespace wins {
+
+namespace {
+  // Running mean and sum of squared deviations, updated one reading at a
+  // time (Welford) and merged pairwise (Chan et al.).
+  struct SignalAccumulator {
+    double count = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void Add(double x) {
+      count += 1;
+      double delta = x - mean;
+      mean += delta / count;
+      m2 += delta * (x - mean);
+    }
+
+    void Merge(const SignalAccumulator& other) {
+      if (other.count == 0) {
+        return;
+      }
+      double total = count + other.count;
+      double delta = other.mean - mean;
+      mean += delta * other.count / total;
+      m2 += other.m2 + delta * delta * count * other.count / total;
+      count = total;
+    }
+  };
+
+  struct SurveyPoint {
+    int x;
+    int y;
+    double scale_x;
+    double scale_y;
+    unordered_map<string, SignalAccumulator> signals;
+    vector<vector<Result>> scans;
+  };
+
+  string Trim(const string& s) {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == string::npos) {
+      return "";
+    }
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+  }
+
+  string Lower(string s) {
+    transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+  }
+
+  bool StartsWith(const string& s, const string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+  }
+
+  vector<SurveyPoint> ParseSurvey(const string& filename,
+      const SurveyOptions& options) {
+    ifstream is(filename);
+    if (not is) {
+      throw runtime_error("Survey file " + filename + " does not exist");
+    }
+
+    vector<SurveyPoint> points;
+    SurveyPoint current = { 0, 0, 1, 1, {}, {} };
+    vector<Result> scan;
+    bool pi_device = false;
+
+    // A MAC heard twice in one scan keeps its last reading.
+    auto flush_scan = [&]() {
+      if (scan.empty()) {
+        return;
+      }
+      for (auto& result : scan) {
+        current.signals[result.name].Add(result.signal);
+      }
+      current.scans.push_back(move(scan));
+      scan.clear();
+    };
+
+    string line;
+    int line_number = 0;
+    while (getline(is, line)) {
+      line_number += 1;
+      line = Trim(line);
+      vector<string> parts;
+      split(line, ',', parts);
+      if (parts.empty() or parts[0].empty()) {
+        continue;
+      }
+      auto fail = [&](const string& reason) {
+        return runtime_error(filename + ":" + to_string(line_number) + ": " +
+            reason);
+      };
+
+      if (StartsWith(parts[0], "start")) {
+        if (parts.size() < 3) {
+          throw fail("start needs x and y");
+        }
+        current.x = stoi(parts[1]);
+        current.y = stoi(parts[2]);
+      } else if (StartsWith(parts[0], "scale")) {
+        if (parts.size() < 3) {
+          throw fail("scale needs x and y");
+        }
+        current.scale_x = stod(parts[1]);
+        current.scale_y = stod(parts[2]);
+      } else if (StartsWith(parts[0], "device")) {
+        if (parts.size() < 2) {
+          throw fail("device needs a name");
+        }
+        pi_device = Lower(Trim(parts[1])) == "pi";
+      } else if (StartsWith(parts[0], "=====")) {
+        flush_scan();
+        int x = current.x;
+        int y = current.y;
+        points.push_back(move(current));
+        current = { x, y, points.back().scale_x, points.back().scale_y,
+            {}, {} };
+        switch (parts[0].size() > 5 ? parts[0][5] : ' ') {
+          case 'N': current.y += 1; break;
+          case 'S': current.y -= 1; break;
+          case 'E': current.x += 1; break;
+          case 'W': current.x -= 1; break;
+          default: throw fail("unknown direction");
+        }
+      } else if (StartsWith(parts[0], "-----")) {
+        flush_scan();
+      } else {
+        string mac;
+        double dbm;
+        if (pi_device) {
+          size_t equals = parts[0].find('=');
+          if (equals == string::npos) {
+            throw fail("expected mac=signal");
+          }
+          mac = parts[0].substr(0, equals);
+          dbm = stod(parts[0].substr(equals + 1));
+        } else {
+          if (parts.size() < 3) {
+            throw fail("expected mac,ssid,signal");
+          }
+          mac = parts[0];
+          dbm = stod(parts[2]);
+        }
+        mac = Lower(Trim(mac));
+        double signal = options.log_scale ?
+            1E+9 * pow(10, dbm / 10) : dbm + 100;
+        auto same = find_if(scan.begin(), scan.end(),
+            [&](const Result& r) { return r.name == mac; });
+        if (same != scan.end()) {
+          same->signal = signal;
+        } else {
+          scan.push_back({ mac, signal });
+        }
+      }
+    }
+    // Readings after the last ===== never belonged to a point.
+    return points;
+  }
+} // anonymous namespace
+
+vector<unique_ptr<Point>> CompileSurveys(const vector<string>& filenames,
+    const SurveyOptions& options, WorkerPool* pool) {
+  vector<vector<SurveyPoint>> surveys(filenames.size());
+  RunChunks(pool, filenames.size(), [&](size_t i) {
+    surveys[i] = ParseSurvey(filenames[i], options);
+  });
+
+  // Pool the surveys in file order so that the result does not depend on
+  // which file finished first.
+  vector<SurveyPoint> merged;
+  map<pair<int, int>, size_t> index;
+  for (auto& survey : surveys) {
+    for (auto& point : survey) {
+      auto found = index.find(make_pair(point.x, point.y));
+      if (found == index.end()) {
+        index[make_pair(point.x, point.y)] = merged.size();
+        merged.push_back(move(point));
+        continue;
+      }
+      auto& target = merged[found->second];
+      for (auto& kv : point.signals) {
+        target.signals[kv.first].Merge(kv.second);
+      }
+      move(point.scans.begin(), point.scans.end(),
+          back_inserter(target.scans));
+    }
+    vector<SurveyPoint>().swap(survey);
+  }
+
+  double min_var = options.log_scale ? SURVEY_MIN_VAR_LOG : SURVEY_MIN_VAR_LIN;
+  vector<unique_ptr<Point>> points;
+  points.reserve(merged.size());
+  for (auto& survey_point : merged) {
+    unique_ptr<Point> point(new Point());
+    point->x = survey_point.x;
+    point->y = survey_point.y;
+    point->cost = { 1, 1, 1, 1 };
+    point->scale_x = survey_point.scale_x;
+    point->scale_y = survey_point.scale_y;
+    for (auto& kv : survey_point.signals) {
+      auto signal = kv.second;
+      double zeros = options.min_signal_count - signal.count;
+      if (zeros > 0) {
+        SignalAccumulator padding;
+        padding.count = zeros;
+        signal.Merge(padding);
+      }
+      // A single reading has no spread, treat it like a tight one.
+      double var = signal.count > 1 ? signal.m2 / (signal.count - 1) : 0;
+      point->info[kv.first] = { signal.mean, max(var, min_var) };
+    }
+    point->scans = move(survey_point.scans);
+    points.push_back(move(point));
+  }
+  return points;
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef SURVEY_COMPILER_H
+#define SURVEY_COMPILER_H
+
+#include "common_utils.h"
+#include "point.h"
+#include "worker_pool.h"
+
+namespace wins {
+
+// Variance floors of the linear (dBm + 100) and log (1E+9 * mW) scales.
+#define SURVEY_MIN_VAR_LIN 10
+#define SURVEY_MIN_VAR_LOG 1E+3
+
+struct SurveyOptions {
+  // MACs heard fewer times than this at a point are padded with zero
+  // readings before the mean and variance are taken.
+  int min_signal_count;
+  bool log_scale;
+};
+
+// Compiles raw survey recordings (start / scale / device lines, scans
+// separated by ----- and points closed by =====<direction>) into map
+// points, keeping the raw scans. Each file walks from its own start and
+// scans recorded at the same position in several files are pooled, in the
+// order the positions were first visited. Files are parsed in parallel on
+// pool when one is given.
+//
+// Throws runtime_error if a file cannot be read or is malformed.
+vector<unique_ptr<Point>> CompileSurveys(const vector<string>& filenames,
+    const SurveyOptions& options, WorkerPool* pool = nullptr);
+
+}
+
+#endif // SURVEY_COMPILER_H
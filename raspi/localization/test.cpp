@@ -1,28 +1,43 @@
 #include "test.h"
 
+#include <cfloat>
+#include <cmath>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <numeric>
+#include <random>
 
 #include "cereal/archives/binary.hpp"
 #include "cereal/archives/json.hpp"
 #include "cereal/types/memory.hpp"
 #include "cereal/types/vector.hpp"
+#include "bench_harness.h"
+#include "chi_squared.h"
 #include "common_utils.h"
+#include "contraction_hierarchy.h"
 #include "display.h"
 #include "global.h"
 #include "imu.h"
+#include "kalman.h"
+#include "kdtree/benchmark.hpp"
 #include "kdtree/kdtree.hpp"
 #include "keypad_handler.h"
+#include "landmarks.h"
 #include "location.h"
 #include "test_helpers.h"
+#include "mahalanobis_kernel.h"
 #include "map.h"
 #include "navigation.h"
 #include "point.h"
+#include "route_replanner.h"
+#include "route_search.h"
 #include "scan_result.h"
+#include "survey_compiler.h"
 #include "gamma.hpp"
 #include "wifi_estimate.h"
+#include "worker_pool.h"
 
 #include <cassert>
 
@@ -32,20 +47,269 @@ void Test(int argc, char *orig_argv[]) {
   vector<string> argv(orig_argv, orig_argv + argc);
 
   if (string(argv[2]) == "make_binary") {
+    // An output name ending in .wmap makes a flat map.
     assert(argc == 5);
     Map::TryConvertJSONMap(argv[3], argv[4]);
+  } else if (string(argv[2]) == "compile_map") {
+    // binary test compile_map <out> <min signal count> lin|log <survey>...
+    assert(argc >= 7);
+    assert(argv[5] == "lin" or argv[5] == "log");
+    SurveyOptions options = { stoi(argv[4]), argv[5] == "log" };
+    vector<string> surveys(argv.begin() + 6, argv.end());
+    WorkerPool pool("compile", max(1u, thread::hardware_concurrency()));
+    vector<unique_ptr<Point>> points;
+    benchmark("CompileSurveys, %zu files", surveys.size()) {
+      points = CompileSurveys(surveys, options, &pool);
+    }
+    Map::WriteMap(argv[3], points);
+    printf("%zu points\n", points.size());
+  } else if (string(argv[2]) == "load_map") {
+    assert(argc == 4);
+    WorkerPool pool("load", max(1u, thread::hardware_concurrency()));
+    benchmark("InitMap(%s)", argv[3].c_str()) {
+      Map::InitMap(argv[3], &pool);
+    }
+    auto& fingerprints = Map::Fingerprints();
+    printf("%zu points, %zu APs\n", fingerprints.num_points(),
+        fingerprints.num_aps());
+  } else if (string(argv[2]) == "contract_map") {
+    // binary test contract_map <map>
+    // Writes the ContractionHierarchy side-car that Navigation routes with
+    // when it is there.
+    assert(argc == 4);
+    Map::InitMap(argv[3]);
+    ContractionHierarchy hierarchy;
+    benchmark("ContractionHierarchy::Build, %zu nodes",
+        Map::Graph().num_nodes()) {
+      hierarchy.Build(Map::Graph());
+    }
+    hierarchy.Write(ContractionHierarchy::FileFor(argv[3]));
+    printf("%zu walk graph edges, %zu upward edges\n",
+        Map::Graph().num_edges(), hierarchy.num_upward_edges());
+  } else if (string(argv[2]) == "index_bench") {
+    // binary test index_bench <map>...
+    // Times NodeNearest and NodesInRadius on the kd-tree and on the grid
+    // index, and checks that both find nodes at the same distances. The
+    // kd-tree is also timed on the batch forms.
+    assert(argc >= 4);
+    const int queries = 200000;
+    WorkerPool pool("query", max(1u, thread::hardware_concurrency()));
+    for (size_t m = 3; m < argv.size(); ++m) {
+      vector<MapCoord> query_points;
+      vector<double> nearest_distances;
+      vector<vector<int>> neighbor_ids;
+      for (auto kind : { MAP_INDEX_KDTREE, MAP_INDEX_GRID }) {
+        Global::MapIndexKind = kind;
+        Map::InitMap(argv[m]);
+        string name = Map::UsesGridIndex() ? "grid" : "kd-tree";
+        auto& points = Map::all_points();
+        if (query_points.empty()) {
+          // Points near the map, most of them close to a surveyed point.
+          srand(1);
+          for (int i = 0; i < queries; ++i) {
+            auto& point = points[rand() % points.size()];
+            double spread = i % 4 == 0 ? 4 : 0.5;
+            query_points.push_back({
+                point->x + spread * (2.0 * rand() / RAND_MAX - 1),
+                point->y + spread * (2.0 * rand() / RAND_MAX - 1) });
+          }
+        }
+        printf("%s, %zu points, %s\n", argv[m].c_str(), points.size(),
+            name.c_str());
+        fflush(stdout);
+
+        vector<kdtree::node<Point*>*> nearest(queries);
+        benchmark("  NodeNearest x %d", queries) {
+          for (int i = 0; i < queries; ++i) {
+            nearest[i] = Map::NodeNearest(query_points[i].x,
+                query_points[i].y);
+          }
+        }
+        vector<kdtree::node<Point*>*> sources;
+        for (int i = 0; i < queries; ++i) {
+          sources.push_back(Map::NodeNearest(points[i % points.size()]->x,
+              points[i % points.size()]->y));
+        }
+        vector<kdtree::node<Point*>*> neighbors;
+        size_t found = 0;
+        benchmark("  NodesInRadius(%g) x %d", NEIGHBOR_RADIUS, queries) {
+          for (auto source : sources) {
+            Map::NodesInRadius(source, NEIGHBOR_RADIUS, neighbors);
+            found += neighbors.size();
+          }
+        }
+        printf("  %.2f neighbors per query\n", (double)found / queries);
+        fflush(stdout);
+
+        if (kind == MAP_INDEX_KDTREE) {
+          // The batch forms on the same queries, which must agree with the
+          // one by one searches.
+          vector<kdtree::node<Point*>*> batch_nearest;
+          benchmark("  NodesNearest batch of %d", queries) {
+            Map::NodesNearest(query_points, batch_nearest, &pool);
+          }
+          assert(batch_nearest == nearest);
+          vector<vector<kdtree::node<Point*>*>> batch_neighbors;
+          benchmark("  NodesInRadius(%g) batch of %d", NEIGHBOR_RADIUS,
+              queries) {
+            Map::NodesInRadius(sources, NEIGHBOR_RADIUS, batch_neighbors,
+                &pool);
+          }
+          for (size_t i = 0; i < points.size(); ++i) {
+            Map::NodesInRadius(sources[i], NEIGHBOR_RADIUS, neighbors);
+            assert(batch_neighbors[i] == neighbors);
+          }
+        }
+
+        bool first = nearest_distances.empty();
+        for (int i = 0; i < queries; ++i) {
+          double d = nearest[i]->distance(query_points[i].x,
+              query_points[i].y);
+          if (first) {
+            nearest_distances.push_back(d);
+          } else {
+            assert(d == nearest_distances[i]);
+          }
+        }
+        for (size_t i = 0; i < points.size(); ++i) {
+          Map::NodesInRadius(sources[i], NEIGHBOR_RADIUS, neighbors);
+          vector<int> ids;
+          for (auto neighbor : neighbors) {
+            ids.push_back(neighbor->point->id);
+          }
+          if (first) {
+            neighbor_ids.push_back(ids);
+          } else {
+            assert(ids == neighbor_ids[i]);
+          }
+        }
+      }
+    }
+  } else if (string(argv[2]) == "query_bench") {
+    // binary test query_bench <out.json> [max points]
+    // Sweeps the kd-tree and grid index over synthetic lattice maps of 1e3
+    // points up to max points, 1e6 by default, and the likely point radii
+    // Location goes through. Writes the timings as JSON.
+    assert(argc == 4 or argc == 5);
+    size_t max_points = argc == 5 ? stoul(argv[4]) : 1000000;
+    const int warmup = 2;
+    const int repetitions = 10;
+    const int k = 10;
+    BenchReport report("query_bench");
+    mt19937 rng(1);
+    for (size_t n = 1000; n <= max_points; n *= 10) {
+      // Half of the cells of a square lattice are surveyed.
+      int side = (int)ceil(sqrt(2.0 * n));
+      vector<int> cells(side * side);
+      iota(cells.begin(), cells.end(), 0);
+      shuffle(cells.begin(), cells.end(), rng);
+      vector<unique_ptr<Point>> points;
+      for (size_t i = 0; i < n; ++i) {
+        points.emplace_back(new Point());
+        points.back()->x = cells[i] % side;
+        points.back()->y = cells[i] / side;
+      }
+      uniform_real_distribution<double> coord(0, side);
+      vector<MapCoord> queries(10000);
+      for (auto& query : queries) {
+        query = { coord(rng), coord(rng) };
+      }
+
+      unique_ptr<kdtree::kdtree<Point*>> tree;
+      report.Add("kdtree_build", { { "points", n } },
+          RunBench(warmup, repetitions, 1, [&] {
+            tree.reset(new kdtree::kdtree<Point*>(&points));
+          }));
+      unique_ptr<GridIndex> grid;
+      report.Add("grid_build", { { "points", n } },
+          RunBench(warmup, repetitions, 1, [&] {
+            grid = GridIndex::TryBuild(*tree);
+          }));
+      assert(grid != nullptr);
+
+      double sink = 0;
+      report.Add("kdtree_nearest", { { "points", n } },
+          RunBench(warmup, repetitions, queries.size(), [&] {
+            for (auto& query : queries) {
+              sink += tree->nearest(query.x, query.y)->x;
+            }
+          }));
+      // With the fallback of Map::NodeNearest for empty cells.
+      report.Add("grid_nearest", { { "points", n } },
+          RunBench(warmup, repetitions, queries.size(), [&] {
+            for (auto& query : queries) {
+              auto node = grid->Nearest(query.x, query.y);
+              if (node == nullptr) {
+                node = tree->nearest(query.x, query.y);
+              }
+              sink += node->x;
+            }
+          }));
+      vector<kdtree::node<Point*>*> neighbors;
+      report.Add("kdtree_k_nearest", { { "points", n }, { "k", k } },
+          RunBench(warmup, repetitions, queries.size(), [&] {
+            for (auto& query : queries) {
+              neighbors.clear();
+              tree->k_nearest(query.x, query.y, k, neighbors);
+            }
+          }));
+
+      // The radii of UpdateLikelyPoints, which does not sort.
+      for (double r = NORMAL_MAX_DIST; r <= MAX_MAX_DIST * MAX_DIST_STEP;
+          r *= MAX_DIST_STEP) {
+        double radius = r * Global::Scale;
+        // Keep every repetition to roughly a million nodes found.
+        double found = min<double>(n, M_PI * radius * radius / 2);
+        size_t count = max<size_t>(1, min<size_t>(queries.size(),
+            1000000 / found));
+        report.Add("kdtree_radius", { { "points", n }, { "radius", radius } },
+            RunBench(warmup, repetitions, count, [&] {
+              for (size_t i = 0; i < count; ++i) {
+                neighbors.clear();
+                tree->radius_nearest(queries[i].x, queries[i].y, radius,
+                    neighbors, false);
+              }
+            }));
+        report.Add("grid_radius", { { "points", n }, { "radius", radius } },
+            RunBench(warmup, repetitions, count, [&] {
+              for (size_t i = 0; i < count; ++i) {
+                neighbors.clear();
+                grid->RadiusNearest(queries[i].x, queries[i].y, radius,
+                    neighbors, false);
+              }
+            }));
+      }
+      // The neighbor radius of Navigation, which sorts.
+      report.Add("kdtree_radius_sorted",
+          { { "points", n }, { "radius", NEIGHBOR_RADIUS } },
+          RunBench(warmup, repetitions, queries.size(), [&] {
+            for (auto& query : queries) {
+              neighbors.clear();
+              tree->radius_nearest(query.x, query.y, NEIGHBOR_RADIUS,
+                  neighbors);
+            }
+          }));
+      report.Add("grid_radius_sorted",
+          { { "points", n }, { "radius", NEIGHBOR_RADIUS } },
+          RunBench(warmup, repetitions, queries.size(), [&] {
+            for (auto& query : queries) {
+              neighbors.clear();
+              grid->RadiusNearest(query.x, query.y, NEIGHBOR_RADIUS,
+                  neighbors);
+            }
+          }));
+      grid.reset();
+      assert(sink > 0);
+    }
+    ofstream os(argv[3]);
+    report.Write(os);
   } else if (string(argv[2]) == "data") {
     assert(argc == 5);
     Map::InitMap(argv[3]);
     ofstream out_file;
     out_file.open("results.csv");
 
-    vector<unique_ptr<Point>> test_points;
-    ifstream is(argv[4], ios::binary);
-    cereal::BinaryInputArchive archive(is);
-
-    archive(test_points);
-    is.close();
+    auto test_points = LoadTestPoints(argv[4]);
 
     auto w = WiFiEstimate();
     int count = 0;
@@ -82,6 +346,69 @@ void Test(int argc, char *orig_argv[]) {
     }
     out_file.close();
   }
+  else if (string(argv[2]) == "mahalanobis") {
+    // Times the Map::Stats path against the fingerprint kernels over every
+    // scan of the test points, scoring each scan against the whole map.
+    assert(argc == 5);
+    Map::InitMap(argv[3]);
+    auto test_points = LoadTestPoints(argv[4]);
+
+    auto& fingerprints = Map::Fingerprints();
+    vector<int> ids;
+    for (auto& point : Map::all_points()) {
+      ids.push_back(point->id);
+    }
+    vector<vector<Result>> scans;
+    for (auto& point : test_points) {
+      scans.insert(scans.end(), point->scans.begin(), point->scans.end());
+    }
+    size_t n = ids.size() * scans.size();
+    vector<double> legacy_sums(n), scalar_sums(n), sums(n);
+    vector<int> legacy_dfs(n), scalar_dfs(n), dfs(n);
+
+    benchmark("Map::Stats, %zu scans x %zu points", scans.size(),
+        ids.size()) {
+      for (size_t s = 0; s < scans.size(); ++s) {
+        for (size_t p = 0; p < ids.size(); ++p) {
+          double sum = 0;
+          int df = 0;
+          for (auto& mac : scans[s]) {
+            string name = mac.name;
+            transform(name.begin(), name.end(), name.begin(), ::tolower);
+            auto stats = Map::Stats(Map::all_points()[p].get(), name,
+                mac.signal);
+            if (stats.mean() < 0) {
+              continue;
+            }
+            sum += pow(stats.dist_mean(), 2);
+            df += 1;
+          }
+          legacy_sums[s * ids.size() + p] = sum;
+          legacy_dfs[s * ids.size() + p] = df;
+        }
+      }
+    }
+    benchmark("scalar kernel") {
+      for (size_t s = 0; s < scans.size(); ++s) {
+        MahalanobisScoresScalar(fingerprints, fingerprints.Intern(scans[s]),
+            ids.data(), ids.size(), &scalar_sums[s * ids.size()],
+            &scalar_dfs[s * ids.size()]);
+      }
+    }
+    benchmark("%s kernel", MahalanobisKernelName()) {
+      for (size_t s = 0; s < scans.size(); ++s) {
+        MahalanobisScores(fingerprints, fingerprints.Intern(scans[s]),
+            ids.data(), ids.size(), &sums[s * ids.size()],
+            &dfs[s * ids.size()]);
+      }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      assert(sums[i] == scalar_sums[i] and dfs[i] == scalar_dfs[i]);
+      assert(sums[i] == legacy_sums[i] and dfs[i] == legacy_dfs[i]);
+    }
+    cout << "sums and dfs match Map::Stats\n";
+  }
   else if (string(argv[2]) == "sample") {
       vector<unique_ptr<Point>> points;
       points.emplace_back(unique_ptr<Point>(new Point {10, 0, {1,1,1,1},
@@ -107,6 +434,70 @@ void Test(int argc, char *orig_argv[]) {
     cout << "pnorm1(1, 0, 0) = " << pnorm1(0, false, true) << "\n";
     cout << "pnorm1(1, 0, 0) = " << pnorm1(0, true, true) << "\n";
     cout << "pnorm1(1, 0, 0) = " << pnorm1(0, true, true) << "\n";
+
+    // Relative error of the upper tail against a long double reference, over
+    // every tabulated df and x from far below to far above the mean.
+    double fast_error = 0;
+    double bound_used = 0;
+    double gamma_error = 0;
+    int gamma_zeros = 0;
+    for (int df = 1; df <= CHI_SQUARED_MAX_DF; ++df) {
+      for (double x = df / 64.0; x < 4 * df + 200; x *= 1.05) {
+        long double reference = ChiSquaredUpperTailReference(x, df);
+        if (reference < DBL_MIN) {
+          continue;
+        }
+        double gamma_tail = 1 - pchisq(x, df);
+        double error = fabsl(
+            (ChiSquaredUpperTail(x, df) - reference) / reference);
+        fast_error = max(fast_error, error);
+        bound_used = max(bound_used, error / ((df + x / 2 + 4) * DBL_EPSILON));
+        if (gamma_tail == 0) {
+          gamma_zeros += 1;
+        } else {
+          gamma_error = max(gamma_error, (double)fabsl(
+              (gamma_tail - reference) / reference));
+        }
+      }
+    }
+    printf("max relative error of the upper tail:\n");
+    printf("  ChiSquaredUpperTail %.3g, %.0f%% of the documented bound\n",
+        fast_error, 100 * bound_used);
+    printf("  1 - pchisq          %.3g, and %d tails rounded to 0\n",
+        gamma_error, gamma_zeros);
+
+    // Speed over the kind of input the CHI_SQ weighting sees.
+    const size_t count = 1000000;
+    vector<double> xs(count), means(count), inv_stds(count), out(count);
+    vector<int> dfs(count);
+    srand(1);
+    for (size_t i = 0; i < count; ++i) {
+      dfs[i] = 5 + rand() % 60;
+      xs[i] = dfs[i] * 4.0 * rand() / RAND_MAX;
+      means[i] = 100.0 * rand() / RAND_MAX;
+      inv_stds[i] = 1 / (1 + 10.0 * rand() / RAND_MAX);
+    }
+    double check = 0;
+    benchmark("1 - pchisq x %zu", count) {
+      for (size_t i = 0; i < count; ++i) {
+        check += 1 - pchisq(xs[i], dfs[i]);
+      }
+    }
+    benchmark("ChiSquaredUpperTails x %zu", count) {
+      ChiSquaredUpperTails(xs.data(), dfs.data(), count, out.data());
+    }
+    check -= accumulate(out.begin(), out.end(), 0.0);
+    benchmark("dnorm x %zu", count) {
+      for (size_t i = 0; i < count; ++i) {
+        check += dnorm(xs[i], means[i], 1 / inv_stds[i]);
+      }
+    }
+    benchmark("NormalDensities x %zu", count) {
+      NormalDensities(xs.data(), means.data(), inv_stds.data(), count,
+          out.data());
+    }
+    check -= accumulate(out.begin(), out.end(), 0.0);
+    printf("difference of the sums: %g\n", check);
   }
   else if (string(argv[2]) == "wifi") {
     std::vector<int> EEchan = { 1, 6, 11, 48, 149, 36, 40, 157, 44, 153,161};
@@ -207,6 +598,462 @@ void Test(int argc, char *orig_argv[]) {
       printf("%3.0f %3.0f\n", (*iter)->point->x, (*iter)->point->y);
     }
   }
+  else if (string(argv[2]) == "nav_poi") {
+    // binary test nav_poi
+    // Routes across the grid of the nav mode to the nearest member of a POI
+    // set read from a side-car with comments and malformed lines.
+    assert(argc == 3);
+    vector<unique_ptr<Point>> points;
+    for (double i = 0; i < 10; ++i) {
+      for (double j = 0; j < 10; ++j) {
+        points.push_back(unique_ptr<Point>(new Point({i, j})));
+      }
+    }
+    Map::TestInitMap(move(points));
+    string poi_file = "nav_poi.poi";
+    {
+      ofstream os(poi_file);
+      os << "# Restrooms and the exit.\n"
+            "restroom 9 0\n"
+            "restroom 0 9\n"
+            "\n"
+            "restroom 6 4\n"
+            "restroom 6.1 4.1\n"
+            "restroom 5\n"
+            "exit 9 9 extra\n"
+            "exit 9 9\n"
+            "bogus line\n";
+    }
+    Map::TestLoadPois(poi_file);
+    remove(poi_file.c_str());
+    assert(Map::Pois().size() == 2);
+    // The second point near (6, 4) snaps to the same node.
+    assert(Map::Pois().Find("restroom")->size() == 3);
+    assert(Map::Pois().Find("exit")->size() == 1);
+    assert(Map::Pois().Find("bogus") == nullptr);
+
+    Location::TestSetCurrentNode(Map::NodeNearest(0, 0));
+    assert(not Navigation::TrySetDestinationFromPoi("nowhere"));
+    assert(Navigation::TrySetDestinationFromPoi("restroom"));
+    Navigation::UpdateRoute();
+    assert(Navigation::GetDestination() == Map::NodeNearest(6, 4));
+    assert(Navigation::route_begin() != Navigation::route_end());
+    assert(*Navigation::route_begin() == Map::NodeNearest(0, 0));
+    assert(*(Navigation::route_end() - 1) == Map::NodeNearest(6, 4));
+    // Moving along the route keeps it.
+    auto route_size = Navigation::route_end() - Navigation::route_begin();
+    Location::TestSetCurrentNode(*(Navigation::route_begin() + 1));
+    Navigation::UpdateRoute();
+    assert(Navigation::route_end() - Navigation::route_begin() == route_size);
+    assert(Navigation::current_begin() == Navigation::route_begin() + 1);
+    for (auto iter = Navigation::route_begin(); iter != Navigation::route_end();
+        ++iter) {
+      printf("%3.0f %3.0f\n", (*iter)->point->x, (*iter)->point->y);
+    }
+  }
+  else if (string(argv[2]) == "nav_hierarchy") {
+    // binary test nav_hierarchy
+    // Checks ContractionHierarchy routes against RouteSearch on a lattice,
+    // a lattice with holes, a maze and two lattices out of reach of each
+    // other: the same route lengths, and routes that only step along walk
+    // graph edges.
+    assert(argc == 3);
+    const int routes = 200;
+    mt19937 rng(1);
+    auto route_length = [](const vector<int32_t>& route) {
+      double length = 0;
+      for (size_t i = 1; i < route.size(); ++i) {
+        length += Map::NodeAt(route[i - 1])->distance(Map::NodeAt(route[i]));
+      }
+      return length;
+    };
+    auto lattice = [](int side, double x0, const function<bool()>& keep,
+        vector<unique_ptr<Point>>& points) {
+      for (double i = 0; i < side; ++i) {
+        for (double j = 0; j < side; ++j) {
+          if (keep()) {
+            points.push_back(unique_ptr<Point>(new Point({x0 + i, j})));
+          }
+        }
+      }
+    };
+    for (string kind : { "lattice", "holed", "maze", "split" }) {
+      vector<unique_ptr<Point>> points;
+      if (kind == "lattice") {
+        lattice(30, 0, [] { return true; }, points);
+      } else if (kind == "holed") {
+        lattice(30, 0, [&rng] { return rng() % 10 != 0; }, points);
+      } else if (kind == "maze") {
+        points = MazeTestPoints(8, rng);
+      } else {
+        lattice(10, 0, [] { return true; }, points);
+        lattice(10, 20, [] { return true; }, points);
+      }
+      Map::TestInitMap(move(points));
+      auto& graph = Map::Graph();
+      ContractionHierarchy hierarchy;
+      hierarchy.Build(graph);
+      RouteSearch search;
+      uniform_int_distribution<int32_t> node(0, graph.num_nodes() - 1);
+      vector<int32_t> route;
+      vector<int32_t> expected;
+      int unreachable = 0;
+      for (int r = 0; r < routes; ++r) {
+        int32_t start = node(rng);
+        // Every tenth route stays where it is.
+        int32_t goal = r % 10 == 0 ? start : node(rng);
+        auto goal_node = Map::NodeAt(goal);
+        bool found = hierarchy.FindRoute(start, goal, route);
+        bool expected_found = search.FindRoute(graph, start, goal,
+            [goal_node](int32_t n) {
+              return Map::NodeAt(n)->distance(goal_node);
+            }, expected);
+        assert(found == expected_found);
+        if (not found) {
+          assert(route.empty());
+          unreachable += 1;
+          continue;
+        }
+        assert(route.front() == goal and route.back() == start);
+        assert(start != goal or route.size() == 1);
+        assert(fabs(route_length(route) - route_length(expected)) < 1e-6);
+        for (size_t i = 1; i < route.size(); ++i) {
+          bool joined = false;
+          for (int32_t e = graph.edges_begin(route[i - 1]);
+              e < graph.edges_end(route[i - 1]); ++e) {
+            joined = joined or graph.target(e) == route[i];
+          }
+          assert(joined);
+        }
+      }
+      // Half of the pairs of the split lattices are on different sides.
+      assert((kind == "split") == (unreachable > 0));
+      printf("%-8s %6zu nodes, %3d routes, %3d unreachable\n", kind.c_str(),
+          graph.num_nodes(), routes, unreachable);
+    }
+  }
+  else if (string(argv[2]) == "nav_bench") {
+    // binary test nav_bench <out.json> [max side]
+    // Times route searches between random nodes of square grids like the
+    // one of the nav mode, 100 by 100 up to max side by max side, 1000 by
+    // default, and replanning as the start drifts. Then times routes across
+    // a maze with and without landmarks, with a contraction hierarchy, and
+    // to the nearest of a set of nodes. Writes the timings as JSON.
+    assert(argc == 4 or argc == 5);
+    int max_side = argc == 5 ? stoi(argv[4]) : 1000;
+    const int routes = 20;
+    BenchReport report("nav_bench");
+    mt19937 rng(1);
+    auto route_length = [](const vector<int32_t>& route) {
+      double length = 0;
+      for (size_t i = 1; i < route.size(); ++i) {
+        length += Map::NodeAt(route[i - 1])->distance(Map::NodeAt(route[i]));
+      }
+      return length;
+    };
+    for (int side = 100; side <= max_side; side *= 10) {
+      vector<unique_ptr<Point>> points;
+      for (double i = 0; i < side; ++i) {
+        for (double j = 0; j < side; ++j) {
+          points.push_back(unique_ptr<Point>(new Point({i, j})));
+        }
+      }
+      Map::TestInitMap(move(points));
+      auto& graph = Map::Graph();
+      uniform_int_distribution<int32_t> node(0, graph.num_nodes() - 1);
+      vector<pair<int32_t, int32_t>> ends;
+      for (int i = 0; i < routes; ++i) {
+        ends.emplace_back(node(rng), node(rng));
+      }
+
+      RouteSearch search;
+      vector<int32_t> route;
+      size_t expanded = 0;
+      size_t length = 0;
+      report.Add("route_search",
+          { { "side", side }, { "edges", graph.num_edges() } },
+          RunBench(1, 5, routes, [&] {
+            expanded = 0;
+            length = 0;
+            for (auto& end : ends) {
+              auto goal = Map::NodeAt(end.second);
+              bool found = search.FindRoute(graph, end.first, end.second,
+                  [goal](int32_t n) { return Map::NodeAt(n)->distance(goal); },
+                  route);
+              assert(found);
+              expanded += search.expanded();
+              length += route.size();
+            }
+          }));
+      fprintf(stderr, "  %zu nodes expanded and %zu on the route per search\n",
+          expanded / routes, length / routes);
+
+      // The user drifting away from the start of each route: a random walk
+      // of short hops, replanning after every hop, from scratch and
+      // incrementally.
+      const int drifts = 10;
+      vector<vector<int32_t>> walks;
+      vector<kdtree::node<Point*>*> nearby;
+      for (auto& end : ends) {
+        vector<int32_t> walk = { end.first };
+        for (int i = 0; i < drifts; ++i) {
+          Map::NodesInRadius(Map::NodeAt(walk.back()), 3, nearby);
+          uniform_int_distribution<size_t> pick(0, nearby.size() - 1);
+          walk.push_back(Map::NodeIndex(nearby[pick(rng)]));
+        }
+        walks.push_back(walk);
+      }
+      vector<double> lengths;
+      report.Add("route_search_drift",
+          { { "side", side }, { "drifts", drifts } },
+          RunBench(1, 5, routes * (drifts + 1), [&] {
+            lengths.clear();
+            for (size_t r = 0; r < ends.size(); ++r) {
+              auto goal = Map::NodeAt(ends[r].second);
+              for (auto start : walks[r]) {
+                search.FindRoute(graph, start, ends[r].second,
+                    [goal](int32_t n) {
+                      return Map::NodeAt(n)->distance(goal);
+                    }, route);
+                lengths.push_back(route_length(route));
+              }
+            }
+          }));
+      RouteReplanner replanner;
+      expanded = 0;
+      report.Add("route_replanner_drift",
+          { { "side", side }, { "drifts", drifts } },
+          RunBench(1, 5, routes * (drifts + 1), [&] {
+            size_t i = 0;
+            expanded = 0;
+            for (size_t r = 0; r < ends.size(); ++r) {
+              for (auto start : walks[r]) {
+                replanner.FindRoute(graph, start, ends[r].second,
+                    [](int32_t from, int32_t to) {
+                      return Map::NodeAt(from)->distance(Map::NodeAt(to));
+                    }, route);
+                assert(fabs(route_length(route) - lengths[i++]) < 1e-6);
+                if (start != walks[r].front()) {
+                  expanded += replanner.expanded();
+                }
+              }
+            }
+          }));
+      fprintf(stderr, "  %zu nodes expanded per incremental replan\n",
+          expanded / (routes * drifts));
+    }
+
+    // Routes across a maze, with the straight-line distance and with
+    // landmarks as the heuristic.
+    int cells = max_side >= 1000 ? 80 : 40;
+    Map::TestInitMap(MazeTestPoints(cells, rng));
+    auto& graph = Map::Graph();
+    Landmarks landmarks;
+    landmarks.Build(graph, LANDMARK_COUNT);
+    uniform_int_distribution<int32_t> node(0, graph.num_nodes() - 1);
+    vector<pair<int32_t, int32_t>> ends;
+    while (ends.size() < routes) {
+      int32_t start = node(rng);
+      int32_t goal = node(rng);
+      // Only routes across at least half the maze.
+      if (fabs(Map::NodeAt(start)->point->x - Map::NodeAt(goal)->point->x) >
+          cells * 3) {
+        ends.emplace_back(start, goal);
+      }
+    }
+    RouteSearch search;
+    vector<int32_t> route;
+    vector<double> lengths;
+    size_t expanded = 0;
+    for (bool use_landmarks : { false, true }) {
+      report.Add(use_landmarks ? "route_search_landmarks" : "route_search_maze",
+          { { "cells", cells }, { "nodes", graph.num_nodes() },
+            { "landmarks", use_landmarks ? landmarks.size() : 0 } },
+          RunBench(1, 5, routes, [&] {
+            expanded = 0;
+            for (size_t r = 0; r < ends.size(); ++r) {
+              int32_t goal = ends[r].second;
+              auto goal_node = Map::NodeAt(goal);
+              search.FindRoute(graph, ends[r].first, goal,
+                  [&](int32_t n) {
+                    double bound = Map::NodeAt(n)->distance(goal_node);
+                    return use_landmarks ?
+                        max(bound, landmarks.LowerBound(n, goal)) : bound;
+                  }, route);
+              double length = route_length(route);
+              if (lengths.size() < ends.size()) {
+                lengths.push_back(length);
+              }
+              assert(fabs(length - lengths[r]) < 1e-6);
+              expanded += search.expanded();
+            }
+          }));
+      fprintf(stderr, "  %zu nodes expanded per search\n", expanded / routes);
+    }
+    ContractionHierarchy hierarchy;
+    benchmark("ContractionHierarchy::Build, %zu nodes", graph.num_nodes()) {
+      hierarchy.Build(graph);
+    }
+    report.Add("route_hierarchy",
+        { { "cells", cells }, { "nodes", graph.num_nodes() },
+          { "upward_edges", hierarchy.num_upward_edges() } },
+        RunBench(1, 5, routes, [&] {
+          expanded = 0;
+          for (size_t r = 0; r < ends.size(); ++r) {
+            hierarchy.FindRoute(ends[r].first, ends[r].second, route);
+            assert(fabs(route_length(route) - lengths[r]) < 1e-6);
+            expanded += hierarchy.expanded();
+          }
+        }));
+    fprintf(stderr, "  %zu nodes expanded per search\n", expanded / routes);
+
+    // The nearest of a set of destinations, in one search and in one search
+    // per member.
+    const int members = 8;
+    vector<int32_t> goals;
+    for (int i = 0; i < members; ++i) {
+      goals.push_back(node(rng));
+    }
+    auto nearest_goal = [&](int32_t n) {
+      double bound = numeric_limits<double>::infinity();
+      for (auto goal : goals) {
+        bound = min(bound, max(Map::NodeAt(n)->distance(Map::NodeAt(goal)),
+            landmarks.LowerBound(n, goal)));
+      }
+      return bound;
+    };
+    vector<double> nearest_lengths;
+    report.Add("route_search_each_member",
+        { { "cells", cells }, { "members", members } },
+        RunBench(1, 5, routes, [&] {
+          nearest_lengths.clear();
+          for (auto& end : ends) {
+            double best = numeric_limits<double>::infinity();
+            for (auto goal : goals) {
+              search.FindRoute(graph, end.first, goal, [&](int32_t n) {
+                    return max(Map::NodeAt(n)->distance(Map::NodeAt(goal)),
+                        landmarks.LowerBound(n, goal));
+                  }, route);
+              best = min(best, route_length(route));
+            }
+            nearest_lengths.push_back(best);
+          }
+        }));
+    report.Add("route_search_nearest_member",
+        { { "cells", cells }, { "members", members } },
+        RunBench(1, 5, routes, [&] {
+          expanded = 0;
+          for (size_t r = 0; r < ends.size(); ++r) {
+            search.FindRouteToNearest(graph, ends[r].first, goals,
+                nearest_goal, route);
+            assert(fabs(route_length(route) - nearest_lengths[r]) < 1e-6);
+            expanded += search.expanded();
+          }
+        }));
+    fprintf(stderr, "  %zu nodes expanded per search\n", expanded / routes);
+    ofstream os(argv[3]);
+    report.Write(os);
+  } else if (string(argv[2]) == "kalman_bench") {
+    // binary test kalman_bench <out.json>
+    // Times the Kalman filter steps of Imu and Location, and the update of
+    // Location with one and with several WiFi estimates, and checks that
+    // none of them allocates. Writes the timings as JSON.
+    assert(argc == 4);
+    const int updates = 100000;
+    BenchReport report("kalman_bench");
+    mt19937 rng(1);
+    normal_distribution<double> noise(0, 1);
+    // Allocations per update of the last case.
+    size_t allocations = 0;
+    CountAllocations(true);
+    auto run = [&](const function<void()>& body) {
+      return RunBench(2, 10, updates, [&] {
+        size_t before = AllocationCount();
+        body();
+        allocations = (AllocationCount() - before) / updates;
+      });
+    };
+
+    {
+      // Position only, as in Location.
+      Eigen::Vector2d X = Eigen::Vector2d::Zero();
+      Eigen::Matrix2d P = Eigen::Matrix2d::Identity();
+      Eigen::Matrix2d I = Eigen::Matrix2d::Identity();
+      vector<Eigen::Vector2d> Z(1024);
+      for (auto& z : Z) {
+        z << noise(rng), noise(rng);
+      }
+      report.Add("kalman_update", { { "state", 2 }, { "measurement", 2 } },
+          run([&] {
+            for (int i = 0; i < updates; ++i) {
+              KalmanUpdate<2, 2>(X, P, Z[i % Z.size()], I, I, I, I, I, I);
+            }
+          }));
+      assert(allocations == 0);
+    }
+    {
+      // Position, velocity and acceleration, as in Imu.
+      const double t = 0.01;
+      Eigen::Matrix<double, SVARS, SVARS> A;
+      A << 1, 0, t, 0, t * t / 2, 0,
+           0, 1, 0, t, 0, t * t / 2,
+           0, 0, 1, 0, t, 0,
+           0, 0, 0, 1, 0, t,
+           0, 0, 0, 0, 1, 0,
+           0, 0, 0, 0, 0, 1;
+      Eigen::Matrix<double, SVARS, SVARS> A_t = A.transpose();
+      Eigen::Matrix<double, SVARS, SVARS> I =
+          Eigen::Matrix<double, SVARS, SVARS>::Identity();
+      Eigen::Matrix<double, SVARS, 1> X =
+          Eigen::Matrix<double, SVARS, 1>::Zero();
+      Eigen::Matrix<double, SVARS, SVARS> P = I;
+      vector<Eigen::Matrix<double, SVARS, 1>> Z(1024);
+      for (auto& z : Z) {
+        for (int j = 0; j < SVARS; ++j) {
+          z(j) = noise(rng);
+        }
+      }
+      report.Add("kalman_update",
+          { { "state", SVARS }, { "measurement", SVARS } },
+          run([&] {
+            for (int i = 0; i < updates; ++i) {
+              KalmanUpdate<SVARS, SVARS>(X, P, Z[i % Z.size()], A, A_t, I,
+                  I, I, I);
+            }
+          }));
+      assert(allocations == 0);
+    }
+
+    vector<unique_ptr<Point>> points;
+    for (double i = 0; i < 10; ++i) {
+      for (double j = 0; j < 10; ++j) {
+        points.push_back(unique_ptr<Point>(new Point({i, j})));
+      }
+    }
+    Map::TestInitMap(move(points));
+    Location::TestInit({}, 0);
+    // A second between updates, as if scanning took that long.
+    Global::DurationOverride = 1000;
+    uniform_real_distribution<double> coord(0, 9);
+    for (int count : { 1, 4 }) {
+      vector<vector<PointEstimate>> estimates(1024);
+      for (auto& e : estimates) {
+        for (int i = 0; i < count; ++i) {
+          e.push_back({ coord(rng), 1, coord(rng), 1 });
+        }
+      }
+      report.Add("location_kalman_update", { { "estimates", count } },
+          run([&] {
+            for (int i = 0; i < updates; ++i) {
+              Location::TestKalmanUpdate(estimates[i % estimates.size()]);
+            }
+          }));
+      assert(allocations == 0);
+    }
+    CountAllocations(false);
+    ofstream os(argv[3]);
+    report.Write(os);
+  }
   else if (string(argv[2]) == "full") {
     string file_name = "Menu.bmp";
     std::ofstream stream(file_name.c_str(),std::ios::binary);
@@ -1,6 +1,8 @@
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 
 #include "test_helpers.h"
 
@@ -13,6 +15,7 @@
 #include "location.h"
 #include "map.h"
 #include "point.h"
+#include "scan_store.h"
 #include "wifi_estimate.h"
 
 namespace wins {
@@ -223,16 +226,82 @@ int AddNextSet(ifstream& fs, FakeWifiScan* fakescanner) {
   return imu_readings;
 }
 
+vector<unique_ptr<Point>> LoadTestPoints(const string& filename) {
+  vector<unique_ptr<Point>> points;
+  ifstream is(filename, ios::binary);
+  cereal::BinaryInputArchive archive(is);
+  archive(points);
+  is.close();
+
+  ifstream sidecar(ScanStore::FileFor(filename));
+  if (sidecar.good()) {
+    ScanStore scans(ScanStore::FileFor(filename));
+    if (not scans.Matches(points)) {
+      throw runtime_error("Scan file does not match " + filename);
+    }
+    for (size_t i = 0; i < points.size(); ++i) {
+      points[i]->scans = scans.Load(i);
+    }
+  }
+  return points;
+}
+
+vector<unique_ptr<Point>> MazeTestPoints(int cells, mt19937& rng) {
+  const int pitch = 6;
+  const int width = 3;
+  // Whether a room has a corridor to the room east and north of it.
+  vector<bool> east(cells * cells), north(cells * cells);
+  // Depth-first carving from room 0.
+  vector<bool> seen(cells * cells);
+  vector<int> stack = { 0 };
+  seen[0] = true;
+  while (not stack.empty()) {
+    int room = stack.back();
+    int x = room % cells;
+    int y = room / cells;
+    vector<int> next;
+    if (x > 0 and not seen[room - 1]) next.push_back(room - 1);
+    if (x < cells - 1 and not seen[room + 1]) next.push_back(room + 1);
+    if (y > 0 and not seen[room - cells]) next.push_back(room - cells);
+    if (y < cells - 1 and not seen[room + cells]) next.push_back(room + cells);
+    if (next.empty()) {
+      stack.pop_back();
+      continue;
+    }
+    int to = next[uniform_int_distribution<size_t>(0, next.size() - 1)(rng)];
+    seen[to] = true;
+    stack.push_back(to);
+    if (to == room + 1 or to == room - 1) {
+      east[min(room, to)] = true;
+    } else {
+      north[min(room, to)] = true;
+    }
+  }
+  for (int room = 0; room < cells * cells; ++room) {
+    if (room % cells < cells - 1 and rng() % 10 == 0) {
+      east[room] = true;
+    }
+  }
+
+  vector<unique_ptr<Point>> points;
+  for (int i = 0; i < cells * pitch; ++i) {
+    for (int j = 0; j < cells * pitch; ++j) {
+      int room = (j / pitch) * cells + i / pitch;
+      bool in_x = i % pitch < width;
+      bool in_y = j % pitch < width;
+      if ((in_x and in_y) or (in_y and east[room]) or (in_x and north[room])) {
+        points.push_back(unique_ptr<Point>(new Point({ (double)i,
+            (double)j })));
+      }
+    }
+  }
+  return points;
+}
+
 void learn_helper(int argc, vector<string> argv) {
   assert(argc == 6);
   Map::InitMap(argv[3]);
-
-  vector<unique_ptr<Point>> test_points;
-  ifstream is(argv[4], ios::binary);
-  cereal::BinaryInputArchive archive(is);
-
-  archive(test_points);
-  is.close();
+  auto test_points = LoadTestPoints(argv[4]);
 
   function<void(vector<unique_ptr<Point>>&, DebugParams)> analysis_func;
   int offset = 0;
@@ -362,4 +431,24 @@ void learn_helper(int argc, vector<string> argv) {
   summary_file.close();
 }
 
+long double ChiSquaredUpperTailReference(long double x, int df) {
+  long double h = x / 2;
+  long double tail = 0;
+  long double term;
+  int j;
+  if (df % 2 == 0) {
+    term = expl(-h);
+    j = 0;
+  } else {
+    tail = erfcl(sqrtl(h));
+    term = expl(-h) * sqrtl(h) * 2 / sqrtl(3.14159265358979323846L);
+    j = 1;
+  }
+  for (; j < (df + 1) / 2; ++j) {
+    tail += term;
+    term *= h / (j + (df % 2 == 0 ? 1 : 0.5L));
+  }
+  return tail;
+}
+
 }
@@ -2,6 +2,8 @@
 #define TEST_HELPERS_H
 
 #include <fstream>
+#include <memory>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -9,6 +11,8 @@ class FakeWifiScan;
 
 namespace wins {
 
+struct Point;
+
 using namespace std;
 using result = tuple<double, double, double, double, double, double>;
 
@@ -23,6 +27,17 @@ struct DebugParams {
 
 void learn_helper(int argc, vector<string> argv);
 int AddNextSet(ifstream& fs, FakeWifiScan* fakescanner);
+// Loads a cereal points file along with the raw scans from its ScanStore
+// side-car, when there is one.
+vector<unique_ptr<Point>> LoadTestPoints(const string& filename);
+// Lattice points along the corridors of a random maze of cells by cells
+// rooms, 6 units apart and joined by corridors 3 units wide. Beyond the
+// corridors of a spanning tree, which leave many dead ends, one in ten rooms
+// gets an extra corridor east so that there are some loops.
+vector<unique_ptr<Point>> MazeTestPoints(int cells, mt19937& rng);
+// Upper tail of the chi-squared distribution for integer df, summed term by
+// term in long double to check the double precision versions against.
+long double ChiSquaredUpperTailReference(long double x, int df);
 
 }
 
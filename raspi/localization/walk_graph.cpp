@@ -0,0 +1,122 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "walk_graph.h"
+
+namespace wins {
+
+#define WALK_GRAPH_BYTE_ORDER 0x01020304
+
+uint64_t WalkGraph::TreeHash(kdtree::kdtree<Point*>& tree) {
+  // FNV-1a over the node coordinates in tree order.
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < tree.size(); ++i) {
+    double coords[2] = { tree.at(i)->x, tree.at(i)->y };
+    auto bytes = reinterpret_cast<const unsigned char*>(coords);
+    for (size_t b = 0; b < sizeof(coords); ++b) {
+      hash = (hash ^ bytes[b]) * 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+void WalkGraph::Build(kdtree::kdtree<Point*>& tree, double radius) {
+  radius_ = radius;
+  tree_hash_ = TreeHash(tree);
+  offsets_.assign(1, 0);
+  targets_.clear();
+  lengths_.clear();
+  vector<kdtree::node<Point*>*> neighbors;
+  for (size_t i = 0; i < tree.size(); ++i) {
+    auto node = tree.at(i);
+    neighbors.clear();
+    tree.radius_nearest(node->x, node->y, radius, neighbors);
+    for (auto neighbor : neighbors) {
+      if (neighbor == node) {
+        continue;
+      }
+      targets_.push_back(neighbor - tree.root());
+      lengths_.push_back(node->distance(neighbor));
+    }
+    offsets_.push_back(targets_.size());
+  }
+}
+
+bool WalkGraph::Load(const string& filename, kdtree::kdtree<Point*>& tree,
+    double radius) {
+  ifstream is(filename, ios::binary);
+  WalkGraphHeader header;
+  is.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (not is or
+      memcmp(header.magic, WALK_GRAPH_MAGIC, sizeof(WALK_GRAPH_MAGIC)) != 0 or
+      header.version != WALK_GRAPH_VERSION or
+      header.byte_order != WALK_GRAPH_BYTE_ORDER or
+      header.num_nodes != tree.size() or header.radius != radius or
+      header.tree_hash != TreeHash(tree)) {
+    return false;
+  }
+  is.seekg(0, ios::end);
+  uint64_t expected = sizeof(header) +
+      (header.num_nodes + 1) * sizeof(int32_t) +
+      header.num_edges * (sizeof(int32_t) + sizeof(double));
+  if ((uint64_t)is.tellg() != expected) {
+    return false;
+  }
+  is.seekg(sizeof(header));
+  vector<int32_t> offsets(header.num_nodes + 1);
+  vector<int32_t> targets(header.num_edges);
+  vector<double> lengths(header.num_edges);
+  is.read(reinterpret_cast<char*>(offsets.data()),
+      offsets.size() * sizeof(int32_t));
+  is.read(reinterpret_cast<char*>(targets.data()),
+      targets.size() * sizeof(int32_t));
+  is.read(reinterpret_cast<char*>(lengths.data()),
+      lengths.size() * sizeof(double));
+  if (not is or offsets.front() != 0 or
+      (uint64_t)offsets.back() != header.num_edges) {
+    return false;
+  }
+  for (size_t i = 0; i < header.num_nodes; ++i) {
+    if (offsets[i] > offsets[i + 1]) {
+      return false;
+    }
+  }
+  for (auto target : targets) {
+    if (target < 0 or (uint64_t)target >= header.num_nodes) {
+      return false;
+    }
+  }
+  radius_ = radius;
+  tree_hash_ = header.tree_hash;
+  offsets_ = move(offsets);
+  targets_ = move(targets);
+  lengths_ = move(lengths);
+  return true;
+}
+
+void WalkGraph::Write(const string& filename) const {
+  WalkGraphHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, WALK_GRAPH_MAGIC, sizeof(WALK_GRAPH_MAGIC));
+  header.version = WALK_GRAPH_VERSION;
+  header.byte_order = WALK_GRAPH_BYTE_ORDER;
+  header.num_nodes = num_nodes();
+  header.num_edges = num_edges();
+  header.tree_hash = tree_hash_;
+  header.radius = radius_;
+
+  ofstream os(filename, ios::binary);
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char*>(offsets_.data()),
+      offsets_.size() * sizeof(int32_t));
+  os.write(reinterpret_cast<const char*>(targets_.data()),
+      targets_.size() * sizeof(int32_t));
+  os.write(reinterpret_cast<const char*>(lengths_.data()),
+      lengths_.size() * sizeof(double));
+  if (not os) {
+    throw runtime_error("Could not write " + filename);
+  }
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef WALK_GRAPH_H
+#define WALK_GRAPH_H
+
+#include <cstdint>
+
+#include "common_utils.h"
+#include "kdtree/kdtree.hpp"
+#include "point.h"
+
+namespace wins {
+
+#define WALK_GRAPH_MAGIC "WINSGRF"
+#define WALK_GRAPH_VERSION 1
+#define WALK_GRAPH_SUFFIX ".graph"
+
+// Which map nodes can be walked between directly: every pair of nodes within
+// a radius of each other, with the distance between them. Nodes are numbered
+// by their index in the kd-tree's node array. The edges of node i are
+// [offsets[i], offsets[i + 1]) into targets and lengths, ordered like a
+// sorted radius search from node i, without node i itself.
+//
+// The graph can be cached in a side-car of the map file. Layout:
+//
+//   header   WalkGraphHeader
+//   offsets  int32_t[num_nodes + 1]
+//   targets  int32_t[num_edges]
+//   lengths  double[num_edges]
+//
+// A side-car only matches a tree with the same node count and coordinates,
+// which the header records as a hash, built with the same radius.
+struct WalkGraphHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t num_nodes;
+  uint64_t num_edges;
+  uint64_t tree_hash;
+  double radius;
+};
+
+class WalkGraph {
+ private:
+  double radius_ = 0;
+  uint64_t tree_hash_ = 0;
+  vector<int32_t> offsets_ = { 0 };
+  vector<int32_t> targets_;
+  vector<double> lengths_;
+
+  static uint64_t TreeHash(kdtree::kdtree<Point*>& tree);
+
+ public:
+  // The side-car name used for a map file.
+  static string FileFor(const string& map_filename) {
+    return map_filename + WALK_GRAPH_SUFFIX;
+  }
+
+  void Build(kdtree::kdtree<Point*>& tree, double radius);
+  // Returns false, leaving the graph as it was, if the file is missing or
+  // does not match the tree and radius.
+  bool Load(const string& filename, kdtree::kdtree<Point*>& tree,
+      double radius);
+  void Write(const string& filename) const;
+
+  size_t num_nodes() const { return offsets_.size() - 1; }
+  size_t num_edges() const { return targets_.size(); }
+  double radius() const { return radius_; }
+  // Identifies the tree the graph was built over, see WalkGraphHeader.
+  uint64_t tree_hash() const { return tree_hash_; }
+  int32_t edges_begin(int32_t node) const { return offsets_[node]; }
+  int32_t edges_end(int32_t node) const { return offsets_[node + 1]; }
+  int32_t target(int32_t edge) const { return targets_[edge]; }
+  double length(int32_t edge) const { return lengths_[edge]; }
+};
+
+}
+
+#endif // WALK_GRAPH_H
@@ -2,14 +2,17 @@
 #include <cmath>
 #include <cstdio>
 #include <fstream>
+#include <limits>
 #include <tuple>
 #include <unordered_map>
 
-#include "gamma.hpp"
+#include "chi_squared.h"
 #include "global.h"
 #include "log.h"
+#include "mahalanobis_kernel.h"
 #include "map.h"
 #include "wifi_estimate.h"
+#include "worker_pool.h"
 
 namespace wins {
 
@@ -18,6 +21,16 @@ namespace wins {
 #define TOP_FEW_GOOD_PROB_THRESH 0.01
 #define TOP_FEW_MIN_PROB_THRESH 0.35
 #define MIN_WEIGHT 1E-37
+// Number of best matches kept for the TOP1 and TOP_FEW variants.
+#define TOP_FEW_COUNT 8
+// Abandoning bounds are loosened by this factor so that rounding in the
+// inverted weight never drops a point that would have made the cut.
+#define ABANDON_SLACK (1 + 1E-9)
+#define ABANDON_REFRESH 1.05
+// Candidates per chunk of scoring work. Partial sums are kept per chunk and
+// added up in chunk order, so estimates depend on this but not on the
+// number of threads.
+#define SCORE_CHUNK 256
 
 // anonymous namespace
 namespace {
@@ -25,12 +38,18 @@ namespace {
     return sqrt(pow(x2-x1, 2) + pow(y2-y1, 2));
   }
 
+  size_t NumChunks(size_t count) {
+    return (count + SCORE_CHUNK - 1) / SCORE_CHUNK;
+  }
+
   vector<tuple<double, double, Point*>> ComputePointStats(
-      vector<Result> s, double realx, double realy, bool debug) {
+      vector<Result> s, double realx, double realy, bool debug,
+      WorkerPool* pool) {
     auto& current_likely_points = Map::CurrentLikelyPoints();
-    vector<tuple<double, double, Point*>> point_stats;
+    auto& fingerprints = Map::Fingerprints();
+    auto scan = fingerprints.Intern(s);
 
-    // Determine the probability of being at each of the possible points.
+    vector<Point*> candidates;
     for (auto& node : current_likely_points) {
       auto point = node->point;
       if (debug and distance(point->x, point->y,
@@ -38,24 +57,170 @@ namespace {
           Global::FilterableDistance) {
         continue;
       }
-      double total_prob = 0;
-      double total_precision = 0;
-      for (auto& mac : s) {
-        string name = mac.name;
-        transform(name.begin(), name.end(), name.begin(), ::tolower);
-        auto stats = Map::Stats(point, name, mac.signal);
-        if (stats.mean() < 0) {
-          //cout << "meean unknown\n";
-          continue;
+      candidates.push_back(point);
+    }
+
+    // Determine the probability of being at each of the possible points.
+    vector<tuple<double, double, Point*>> point_stats(candidates.size());
+    RunChunks(pool, NumChunks(candidates.size()), [&](size_t chunk) {
+      size_t end = min(candidates.size(), (chunk + 1) * SCORE_CHUNK);
+      vector<double> signals(scan.size());
+      vector<double> means(scan.size());
+      vector<double> inv_stds(scan.size());
+      vector<double> precisions(scan.size());
+      vector<double> probs(scan.size());
+      for (size_t c = chunk * SCORE_CHUNK; c < end; ++c) {
+        auto point = candidates[c];
+        auto mean = fingerprints.mean_row(point->id);
+        auto var = fingerprints.var_row(point->id);
+        auto inv_std = fingerprints.inv_std_row(point->id);
+        auto seen = fingerprints.presence_row(point->id);
+        size_t n = 0;
+        for (size_t i = 0; i < scan.size(); ++i) {
+          int ap = scan.ap[i];
+          if (not FingerprintStore::Seen(seen, ap)) {
+            continue;
+          }
+          signals[n] = scan.signal[i];
+          means[n] = mean[ap];
+          inv_stds[n] = inv_std[ap];
+          precisions[n] = 1 / var[ap];
+          n += 1;
         }
-        total_prob += stats.prob() * stats.precision();
-        total_precision += stats.precision();
+        NormalDensities(signals.data(), means.data(), inv_stds.data(), n,
+            probs.data());
+        double total_prob = 0;
+        double total_precision = 0;
+        for (size_t i = 0; i < n; ++i) {
+          total_prob += probs[i] * precisions[i];
+          total_precision += precisions[i];
+        }
+        point_stats[c] = make_tuple(total_prob, total_precision, point);
       }
-      point_stats.push_back(make_tuple(total_prob, total_precision, point));
-    }
+    });
     return point_stats;
   }
 
+  double MahalanobisWeight(WiFiVariant v, double sum, int df, double exp1,
+      double exp2) {
+    if (v & WIFI_VARIANT_CHI_SQ) {
+      return pow(df, exp1) * pow(100.0 * ChiSquaredUpperTail(sum, df), exp2);
+    }
+    return pow(df, exp1) / pow(sum, exp2);
+  }
+
+  // Returns a Mahalanobis sum past which a point with df shared APs can no
+  // longer weigh more than weight. The weight only falls as the sum grows
+  // when exp2 > 0, otherwise nothing can be abandoned.
+  double AbandonBound(WiFiVariant v, int df, double weight, double exp1,
+      double exp2) {
+    const double never = numeric_limits<double>::infinity();
+    if (exp2 <= 0) {
+      return never;
+    }
+    if (not (v & WIFI_VARIANT_CHI_SQ)) {
+      return pow(pow(df, exp1) / weight, 1 / exp2) * ABANDON_SLACK;
+    }
+
+    // Invert the upper tail of the chi-squared distribution by bisection.
+    double tail = pow(weight / pow(df, exp1), 1 / exp2) / 100.0;
+    if (tail >= 1) {
+      return 0;
+    }
+    if (tail <= 0) {
+      return never;
+    }
+    double lo = 0;
+    double hi = df;
+    while (ChiSquaredUpperTail(hi, df) > tail) {
+      lo = hi;
+      hi *= 2;
+      if (hi > 1E6) {
+        return never;
+      }
+    }
+    // hi always satisfies the bound, a loose bracket only abandons less.
+    while (hi - lo > hi * 1E-6) {
+      double mid = (lo + hi) / 2;
+      if (ChiSquaredUpperTail(mid, df) > tail) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    return hi * ABANDON_SLACK;
+  }
+
+  struct Match {
+    double weight;
+    size_t index;
+  };
+
+  // Earlier candidates win ties so the result does not depend on the heap.
+  bool BetterMatch(const Match& a, const Match& b) {
+    return a.weight > b.weight or (a.weight == b.weight and a.index < b.index);
+  }
+
+  // Keeps the TOP_FEW_COUNT heaviest candidates in a bounded heap with the
+  // worst kept match on top. Once the heap is full, a candidate is scored
+  // only until its partial sum shows it cannot beat that match.
+  vector<Match> TopMatches(const FingerprintStore& fingerprints,
+      const InternedScan& scan, const vector<int>& ids, const vector<int>& dfs,
+      size_t begin, size_t end, WiFiVariant v, double exp1, double exp2) {
+    vector<Match> heap;
+    heap.reserve(TOP_FEW_COUNT);
+    // Bounds depend only on df and the worst kept weight. A bound computed for
+    // a lower weight abandons less but is still safe, so the cached bound of a
+    // df is only refreshed once the worst weight has grown noticeably.
+    vector<double> bounds;
+    vector<double> bound_weights;
+    for (size_t i = begin; i < end; ++i) {
+      int df = dfs[i];
+      double bound = numeric_limits<double>::infinity();
+      if (heap.size() == TOP_FEW_COUNT) {
+        double worst = heap.front().weight;
+        if ((size_t)df >= bounds.size()) {
+          bounds.resize(df + 1);
+          bound_weights.resize(df + 1, -1);
+        }
+        if (worst > bound_weights[df] * ABANDON_REFRESH) {
+          bounds[df] = AbandonBound(v, df, worst, exp1, exp2);
+          bound_weights[df] = worst;
+        }
+        bound = bounds[df];
+      }
+
+      double sum;
+      if (not MahalanobisScoreBounded(fingerprints, scan, ids[i], bound,
+          &sum) or sum <= 0) {
+        continue;
+      }
+      Match match = { MahalanobisWeight(v, sum, df, exp1, exp2), i };
+      if (heap.size() < TOP_FEW_COUNT) {
+        heap.push_back(match);
+        push_heap(heap.begin(), heap.end(), BetterMatch);
+      } else if (BetterMatch(match, heap.front())) {
+        pop_heap(heap.begin(), heap.end(), BetterMatch);
+        heap.back() = match;
+        push_heap(heap.begin(), heap.end(), BetterMatch);
+      }
+    }
+    sort_heap(heap.begin(), heap.end(), BetterMatch);
+    return heap;
+  }
+
+  struct WeightedSums {
+    double total_weight = 0;
+    double x = 0;
+    double y = 0;
+
+    void Add(const WeightedSums& other) {
+      total_weight += other.total_weight;
+      x += other.x;
+      y += other.y;
+    }
+  };
+
 } // anonymous namespace
 
 vector<PointEstimate> WiFiEstimate::ClosestByMahalanobis(vector<Result> s,
@@ -64,51 +229,126 @@ vector<PointEstimate> WiFiEstimate::ClosestByMahalanobis(vector<Result> s,
   using stat = tuple<double, Point*, double, double>;
 
   auto& current_likely_points = Map::CurrentLikelyPoints();
-  vector<stat> point_stats;
-
-  // Determine the probability of being at each of the possible points from
-  // Mahalanobis distance.
-  //FILE_LOG(logWIFI) << "likely points = " << current_likely_points.size() << "\n";
+  auto& fingerprints = Map::Fingerprints();
+  auto scan = fingerprints.Intern(s);
+
+  // Count, through the inverted index, how many scanned APs every point has
+  // seen. Only points that can reach MIN_DF are worth scoring, so the scorer
+  // does work proportional to the points sharing APs with the scan rather
+  // than to the likely points, which may be the whole map.
+  shared_aps_.resize(fingerprints.num_points());
+  fingerprints.CountSharedAps(scan, shared_aps_);
+  vector<Point*> candidates;
+  vector<int> candidate_ids;
+  vector<int> candidate_dfs;
   for (auto& node : current_likely_points) {
     auto point = node->point;
+    if (shared_aps_[point->id] < MIN_DF) {
+      continue;
+    }
     if (debug and distance(point->x, point->y, realx - Global::FilterBiasX,
         realy - Global::FilterBiasY) > Global::FilterableDistance) {
       continue;
     }
-    double sum = 0;
-    int df = 0;
-    for (auto& mac : s) {
-			string name = mac.name;
-			transform(name.begin(), name.end(), name.begin(), ::tolower);
-      auto stats = Map::Stats(point, name, mac.signal);
-      if (stats.mean() < 0) {
-				//cout << name << " never seen before\n";
-        continue;
+    candidates.push_back(point);
+    candidate_ids.push_back(point->id);
+    candidate_dfs.push_back(shared_aps_[point->id]);
+  }
+  fingerprints.ClearSharedAps(scan, shared_aps_);
+
+  vector<PointEstimate> estimates;
+  size_t chunks = NumChunks(candidates.size());
+  if (v & WIFI_VARIANT_TOP1 or v & WIFI_VARIANT_TOP_FEW) {
+    // The best matches overall are among the best of each chunk, and
+    // BetterMatch is a total order, so merging the chunks gives the same
+    // matches as a single pass would.
+    vector<vector<Match>> chunk_matches(chunks);
+    RunChunks(pool_, chunks, [&](size_t chunk) {
+      chunk_matches[chunk] = TopMatches(fingerprints, scan, candidate_ids,
+          candidate_dfs, chunk * SCORE_CHUNK,
+          min(candidates.size(), (chunk + 1) * SCORE_CHUNK), v, exp1, exp2);
+    });
+    vector<Match> matches;
+    for (auto& chunk_match : chunk_matches) {
+      matches.insert(matches.end(), chunk_match.begin(), chunk_match.end());
+    }
+    sort(matches.begin(), matches.end(), BetterMatch);
+    if (matches.size() > TOP_FEW_COUNT) {
+      matches.resize(TOP_FEW_COUNT);
+    }
+    if (matches.size() == 0) {
+      FILE_LOG(logWIFI) << "-------------------Algorithm found no estimaes!!!\n";
+      return estimates;
+    }
+    // Normalize over the kept matches, the variance of an estimate is one
+    // minus its share of the weight.
+    double total_weight = 0;
+    for (auto& match : matches) {
+      total_weight += max(match.weight, MIN_WEIGHT);
+    }
+    for (auto& match : matches) {
+      double prob = max(match.weight, MIN_WEIGHT) / total_weight;
+      if (v & WIFI_VARIANT_TOP_FEW and prob <= TOP_FEW_GOOD_PROB_THRESH) {
+        break;
+      }
+      auto point = candidates[match.index];
+      estimates.push_back({ point->x, 1 - prob, point->y, 1 - prob });
+      if (v & WIFI_VARIANT_TOP1) {
+        break;
       }
-      sum += pow(stats.dist_mean(), 2);
-      df += 1;
     }
-    if (df < MIN_DF) {
-      FILE_LOG(logWIFI) << "--------------------------df low!!!\n";
-      continue;
+    return estimates;
+  }
+
+  // Determine the probability of being at each of the possible points from
+  // Mahalanobis distance. Points without a stat are left with a null point.
+  //FILE_LOG(logWIFI) << "likely points = " << current_likely_points.size() << "\n";
+  vector<stat> point_stats(candidates.size(), make_tuple(0, nullptr, 0, 0));
+  vector<WeightedSums> chunk_means(chunks);
+  RunChunks(pool_, chunks, [&](size_t chunk) {
+    size_t begin = chunk * SCORE_CHUNK;
+    size_t end = min(candidates.size(), begin + SCORE_CHUNK);
+    double sums[SCORE_CHUNK];
+    int dfs[SCORE_CHUNK];
+    double tails[SCORE_CHUNK];
+    MahalanobisScores(fingerprints, scan, &candidate_ids[begin], end - begin,
+        sums, dfs);
+    if (v & WIFI_VARIANT_CHI_SQ) {
+      ChiSquaredUpperTails(sums, dfs, end - begin, tails);
     }
+    auto& partial = chunk_means[chunk];
+    for (size_t i = begin; i < end; ++i) {
+      auto point = candidates[i];
+      double sum = sums[i - begin];
+      int df = dfs[i - begin];
+
+      //point_stats.push_back(ChiSquaredProbability(sum, df));
+      if (df > 0 and sum > 0) {
+        if (v & WIFI_VARIANT_CHI_SQ)
+          // Square of M-distance is ch-sqaured.
+          // Weight of a point is the probability that the collected signal
+          // data was taken at that point.
+          point_stats[i] = make_tuple(
+                pow(df, exp1) * pow(100.0 * tails[i - begin], exp2),
+                point, df, 1.0 - tails[i - begin]);
+        else
+          // Weight of a point is proportional to the number of APs common to
+          // that location and inversely proportinal to the M-distance.
+          point_stats[i] = make_tuple(pow(df, exp1) / pow(sum, exp2),
+                point, pow(df, exp1), pow(sum, exp2));
+      } else {
+        continue;
+      }
 
-    //point_stats.push_back(ChiSquaredProbability(sum, df));
-    if (df > 0 and sum > 0) {
-      if (v & WIFI_VARIANT_CHI_SQ)
-        // Square of M-distance is ch-sqaured.
-        // Weight of a point is the probability that the collected signal data
-        // was taken at that point.
-        point_stats.push_back(make_tuple(
-              pow(df, exp1) * pow(100.0 * (1.0 - pchisq(sum, df)), exp2),
-              point, df, pchisq(sum, df)));
-      else
-        // Weight of a point is proportional to the number of APs common to
-        // that location and inversely proportinal to the M-distance.
-        point_stats.push_back(make_tuple(pow(df, exp1) / pow(sum, exp2),
-              point, pow(df, exp1), pow(sum, exp2)));
+      double weight = get<0>(point_stats[i]);
+      if (weight < MIN_WEIGHT) {
+        weight = MIN_WEIGHT;
+      }
+      partial.total_weight += weight;
+      partial.x += point->x * weight;
+      partial.y += point->y * weight;
     }
-  }
+  });
 
   //DEBUG CODE
   //char buffer[100];
@@ -129,72 +369,44 @@ vector<PointEstimate> WiFiEstimate::ClosestByMahalanobis(vector<Result> s,
   //  FILE_LOG(logWIFI) << buffer;
   //}
 
-//  if (v & WIFI_VARIANT_TOP1 or v & WIFI_VARIANT_TOP_FEW) {
-//    sort(point_stats.begin(), point_stats.end(),
-//        [](const stat &a, const stat &b) -> bool {
-//            return get<0>(a) > get<0>(b);
-//        });
-//    if (v & WIFI_VARIANT_TOP1) {
-//      estimates.push_back({
-//          get<1>(point_stats[0])->x,
-//          1 - get<0>(point_stats[0]),
-//          get<1>(point_stats[0])->y,
-//          1 - get<0>(point_stats[0])
-//      });
-//    } else if (v & WIFI_VARIANT_TOP_FEW) {
-//      for (auto p_stat : point_stats) {
-//        // if (p_stat.first < TOP_FEW_MIN_PROB)
-//        //   continue;
-//        if (get<0>(p_stat) > TOP_FEW_GOOD_PROB_THRESH) {
-//          estimates.push_back({
-//              get<1>(p_stat)->x, 1 - get<0>(p_stat),
-//              get<1>(p_stat)->y, 1 - get<0>(p_stat)});
-//        }
-//      }
-//    }
-  vector<PointEstimate> estimates;
-  if (point_stats.size() == 0) {
+  WeightedSums means;
+  for (auto& partial : chunk_means) {
+    means.Add(partial);
+  }
+  if (means.total_weight == 0) {
 		FILE_LOG(logWIFI) << "-------------------Algorithm found no estimaes!!!\n";
     return estimates;
   }
-
-  if (v & WIFI_VARIANT_TOP1 or v & WIFI_VARIANT_TOP_FEW) {
-    throw runtime_error("Not Supported");
-  } else {
-    double pred_x = 0;
-    double pred_y = 0;
-    double total_weight = 0;
-    for (auto&& p_stat : point_stats) {
-      double weight = get<0>(p_stat);
-      if (weight < MIN_WEIGHT) {
-        weight = MIN_WEIGHT;
+  double pred_x = means.x / means.total_weight;
+  double pred_y = means.y / means.total_weight;
+
+  vector<WeightedSums> chunk_vars(chunks);
+  RunChunks(pool_, chunks, [&](size_t chunk) {
+    size_t end = min(candidates.size(), (chunk + 1) * SCORE_CHUNK);
+    auto& partial = chunk_vars[chunk];
+    for (size_t i = chunk * SCORE_CHUNK; i < end; ++i) {
+      auto& p_stat = point_stats[i];
+      if (get<1>(p_stat) == nullptr) {
+        continue;
       }
-      total_weight += weight;
-      pred_x += get<1>(p_stat)->x * weight;
-      pred_y += get<1>(p_stat)->y * weight;
-    }
-
-    pred_x /= total_weight;
-    pred_y /= total_weight;
-
-    double var_x = 0;
-    double var_y = 0;
-    double total_weight_var = 0;
-    for (auto&& p_stat : point_stats) {
       double weight = get<2>(p_stat);
-      total_weight_var += weight;
-      var_x += pow(pred_x - get<1>(p_stat)->x, 2) * weight;
-      var_y += pow(pred_y - get<1>(p_stat)->y, 2) * weight;
+      partial.total_weight += weight;
+      partial.x += pow(pred_x - get<1>(p_stat)->x, 2) * weight;
+      partial.y += pow(pred_y - get<1>(p_stat)->y, 2) * weight;
     }
+  });
 
-    var_x /= total_weight_var;
-    var_y /= total_weight_var;
-
-    estimates.push_back({ /* x_mean */ pred_x,
-                          /* x_var */ var_x,
-                          /* y_mean */ pred_y,
-                          /* y_var */ var_y});
+  WeightedSums vars;
+  for (auto& partial : chunk_vars) {
+    vars.Add(partial);
   }
+  double var_x = vars.x / vars.total_weight;
+  double var_y = vars.y / vars.total_weight;
+
+  estimates.push_back({ /* x_mean */ pred_x,
+                        /* x_var */ var_x,
+                        /* y_mean */ pred_y,
+                        /* y_var */ var_y});
 
   //printf("%3s %3s %10s %7s %2s\n", "--x", "y", "chi", "ssum", "df");
   //for (int i = 0; i < point_stats.size(); ++i) {
@@ -211,7 +423,7 @@ vector<PointEstimate> WiFiEstimate::ClosestByMahalanobis(vector<Result> s,
 
 vector<PointEstimate> WiFiEstimate::MostProbableClubbed(vector<Result> s,
     double realx, double realy, double exp1, double exp2, bool debug) {
-  auto point_stats = ComputePointStats(s, realx, realy, debug);
+  auto point_stats = ComputePointStats(s, realx, realy, debug, pool_);
 
   // Club all points with same x together and all points with the same y
   // together.
@@ -294,7 +506,8 @@ vector<PointEstimate> WiFiEstimate::MostProbableClubbed(vector<Result> s,
 
 vector<PointEstimate> WiFiEstimate::MostProbableNotClubbed(vector<Result> s,
     double realx, double realy, double exp1, double exp2, bool debug) {
-  vector<tuple<double, double, Point*>> point_stats = ComputePointStats(s, realx, realy, debug);
+  vector<tuple<double, double, Point*>> point_stats = ComputePointStats(s,
+      realx, realy, debug, pool_);
   //DEBUG CODE
   //char buffer[100];
   //sprintf(buffer, "\n%7s %7s %7s %7s %7s\n",
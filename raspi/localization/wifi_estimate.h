@@ -4,6 +4,7 @@
 #include "common_utils.h"
 #include "scan_result.h"
 #include "wifiscan.h"
+#include "worker_pool.h"
 
 namespace wins {
 
@@ -28,6 +29,14 @@ class WiFiEstimate {
   WiFiEstimate() {}
   vector<PointEstimate> EstimateLocation(WiFiVariant v, int read_count = 1);
   vector<Result> GetScans();
+  // Scoring is split across pool when one is set, the pool must outlive the
+  // estimator's use of it.
+  void SetComputePool(WorkerPool* pool) { pool_ = pool; }
+
+ private:
+  WorkerPool* pool_ = nullptr;
+  // Per point count of shared APs, kept zeroed between scans.
+  vector<int> shared_aps_;
 };
 
 }
@@ -0,0 +1,155 @@
+#include <pthread.h>
+
+#include "log.h"
+#include "worker_pool.h"
+
+namespace wins {
+
+using namespace std;
+
+namespace {
+void PinToCpu(int cpu) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    FILE_LOG(logWARNING) << "Could not pin worker to cpu " << cpu << "\n";
+  }
+#endif
+}
+
+// Shared with the helper tasks. A helper may only get to run after every
+// chunk is done and RunChunks has returned, so it must not touch the caller.
+struct ChunkState {
+  function<void(size_t)> body;
+  size_t count;
+  atomic<size_t> next;
+  size_t done = 0;
+  exception_ptr error;
+  mutex done_mutex;
+  condition_variable all_done;
+};
+
+void RunChunksFrom(const shared_ptr<ChunkState>& state) {
+  size_t chunk;
+  while ((chunk = state->next.fetch_add(1)) < state->count) {
+    exception_ptr error;
+    try {
+      state->body(chunk);
+    } catch (...) {
+      error = current_exception();
+    }
+    lock_guard<mutex> lock(state->done_mutex);
+    if (error and not state->error) {
+      state->error = error;
+    }
+    state->done += 1;
+    if (state->done == state->count) {
+      state->all_done.notify_all();
+    }
+  }
+}
+}
+
+WorkerPool::WorkerPool(const string& name, int threads, int first_cpu)
+    : name_(name) {
+  int cpus = max(1u, thread::hardware_concurrency());
+  for (int i = 0; i < threads; ++i) {
+    int cpu = first_cpu < 0 ? -1 : (first_cpu + i) % cpus;
+    workers_.push_back(thread(&WorkerPool::MainLoop, this, cpu));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    terminate_ = true;
+  }
+  task_pending_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void WorkerPool::Enqueue(function<void()> run) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    queue_.push_back({ move(run), chrono::steady_clock::now() });
+  }
+  task_pending_.notify_one();
+}
+
+void WorkerPool::MainLoop(int cpu) {
+  if (cpu >= 0) {
+    PinToCpu(cpu);
+  }
+  while (true) {
+    Task task;
+    {
+      unique_lock<mutex> lock(mutex_);
+      task_pending_.wait(lock, [this] {
+        return terminate_ or not queue_.empty();
+      });
+      if (queue_.empty()) {
+        return;
+      }
+      task = move(queue_.front());
+      queue_.pop_front();
+    }
+
+    // Exceptions are captured by the packaged_task and rethrown from the
+    // future, so run never throws here.
+    task.run();
+
+    double latency_ms = chrono::duration<double, milli>(
+        chrono::steady_clock::now() - task.submitted).count();
+    lock_guard<mutex> lock(mutex_);
+    tasks_done_ += 1;
+    last_latency_ms_ = latency_ms;
+    total_latency_ms_ += latency_ms;
+    max_latency_ms_ = max(max_latency_ms_, latency_ms);
+  }
+}
+
+size_t WorkerPool::QueueDepth() const {
+  lock_guard<mutex> lock(mutex_);
+  return queue_.size();
+}
+
+WorkerPoolStats WorkerPool::Stats() const {
+  lock_guard<mutex> lock(mutex_);
+  return { queue_.size(), tasks_done_, last_latency_ms_,
+      tasks_done_ > 0 ? total_latency_ms_ / tasks_done_ : 0,
+      max_latency_ms_ };
+}
+
+void RunChunks(WorkerPool* pool, size_t count,
+    const function<void(size_t)>& body) {
+  if (pool == nullptr or count < 2) {
+    for (size_t chunk = 0; chunk < count; ++chunk) {
+      body(chunk);
+    }
+    return;
+  }
+
+  auto state = make_shared<ChunkState>();
+  state->body = body;
+  state->count = count;
+  state->next = 0;
+  size_t helpers = min(count - 1, pool->size());
+  for (size_t i = 0; i < helpers; ++i) {
+    pool->Submit([state]() { RunChunksFrom(state); });
+  }
+  RunChunksFrom(state);
+
+  unique_lock<mutex> lock(state->done_mutex);
+  state->all_done.wait(lock, [&state] {
+    return state->done == state->count;
+  });
+  if (state->error) {
+    rethrow_exception(state->error);
+  }
+}
+
+}
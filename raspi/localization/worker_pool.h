@@ -0,0 +1,83 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include <thread>
+#include <type_traits>
+
+#include "common_utils.h"
+
+namespace wins {
+
+// Latency of a task is measured from Submit until it has finished running,
+// so it includes the time spent waiting in the queue.
+struct WorkerPoolStats {
+  size_t queue_depth;
+  uint64_t tasks_done;
+  double last_latency_ms;
+  double mean_latency_ms;
+  double max_latency_ms;
+};
+
+// A fixed set of long-lived threads fed from one FIFO queue. The threads are
+// started by the constructor and joined by the destructor, after the queue
+// has drained.
+class WorkerPool {
+ private:
+  struct Task {
+    function<void()> run;
+    chrono::steady_clock::time_point submitted;
+  };
+
+  string name_;
+  vector<thread> workers_;
+  deque<Task> queue_;
+  mutable mutex mutex_;
+  condition_variable task_pending_;
+  bool terminate_ = false;
+
+  uint64_t tasks_done_ = 0;
+  double last_latency_ms_ = 0;
+  double total_latency_ms_ = 0;
+  double max_latency_ms_ = 0;
+
+  void Enqueue(function<void()> run);
+  void MainLoop(int cpu);
+
+  WorkerPool(WorkerPool const&) = delete;
+  void operator=(WorkerPool const&) = delete;
+
+ public:
+  // Worker i is pinned to core (first_cpu + i) modulo the number of cores.
+  // A negative first_cpu leaves the workers to the scheduler.
+  WorkerPool(const string& name, int threads, int first_cpu = -1);
+  ~WorkerPool();
+
+  template <typename F>
+  future<typename result_of<F()>::type> Submit(F f) {
+    using R = typename result_of<F()>::type;
+    auto task = make_shared<packaged_task<R()>>(move(f));
+    future<R> result = task->get_future();
+    Enqueue([task]() { (*task)(); });
+    return result;
+  }
+
+  size_t size() const { return workers_.size(); }
+  const string& name() const { return name_; }
+  size_t QueueDepth() const;
+  WorkerPoolStats Stats() const;
+};
+
+// Calls body(chunk) once for every chunk in [0, count). Chunks are handed
+// out on demand to the calling thread and to helpers on the pool, so a busy
+// or slow core just ends up taking fewer of them. Returns once every chunk
+// has run and rethrows the first exception a chunk threw. A null pool runs
+// the chunks in order on the calling thread.
+void RunChunks(WorkerPool* pool, size_t count,
+    const function<void(size_t)>& body);
+
+}
+
+#endif // WORKER_POOL_H